@@ -60,6 +60,29 @@ struct __attribute__ ((__packed__)) product_info_area {
     struct fru_type_length tl[];
 };
 
+/* 16. MultiRecord Area
+ * Every record starts with this header, the record data follows it
+ */
+struct multirecord_header {
+    uint8_t     type_id;
+    uint8_t     format;         /* end of list flag and format version */
+    uint8_t     length;         /* of the record data */
+    uint8_t     record_checksum;
+    uint8_t     header_checksum;
+};
+
+#define MR_END_OF_LIST      0x80
+#define MR_FORMAT_VERSION   0x02
+
+/* 18. Record type IDs */
+enum multirecord_type {
+    MR_TYPE_POWER_SUPPLY        = 0x00,
+    MR_TYPE_DC_OUTPUT           = 0x01,
+    MR_TYPE_DC_LOAD             = 0x02,
+    MR_TYPE_MANAGEMENT_ACCESS   = 0x03,
+    MR_TYPE_OEM                 = 0xc0,     /* 0xc0 - 0xff */
+};
+
 /* Type code */
 enum fru_type_code {
     TYPE_CODE_BINARY    = 0x00,
@@ -0,0 +1,442 @@
+#include <string.h>
+
+#include "fru-simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FRU_SIMD_X86
+#include <immintrin.h>
+#endif
+
+static void pack_ascii6_scalar(const char *str, int len, uint8_t *dst)
+{
+    int i, j;
+
+    j = 0;
+    for (i = 0; i+3 < len; i += 4) {
+        *(dst + j) = get_6bit_ascii(str[i]) | (get_6bit_ascii(str[i+1]) << 6);
+        *(dst + j + 1) = (get_6bit_ascii(str[i+1]) >> 2) | (get_6bit_ascii(str[i+2]) << 4);
+        *(dst + j + 2) = (get_6bit_ascii(str[i+2]) >> 4) | (get_6bit_ascii(str[i+3]) << 2);
+        j += 3;
+    }
+
+    /* pack remaining (< 4) bytes */
+    switch ((len - i) % 4) {
+        case 3:
+            *(dst + j) = get_6bit_ascii(str[i]) | (get_6bit_ascii(str[i+1]) << 6);
+            *(dst + j + 1) = (get_6bit_ascii(str[i+1]) >> 2) | (get_6bit_ascii(str[i+2]) << 4);
+            *(dst + j + 2) = get_6bit_ascii(str[i+2]) >> 4;
+            break;
+        case 2:
+            *(dst + j) = get_6bit_ascii(str[i]) | (get_6bit_ascii(str[i+1]) << 6);
+            *(dst + j + 1) = get_6bit_ascii(str[i+1]) >> 2;
+            break;
+        case 1:
+            *(dst + j) = get_6bit_ascii(str[i]);
+        default:
+            break;
+    }
+}
+
+static void unpack_ascii6_scalar(const uint8_t *src, int nchars, char *str)
+{
+    int i, nbytes;
+    uint32_t bits;
+
+    nbytes = get_ascii6_size(nchars);
+    for (i = 0; i < nchars; i++) {
+        /* each char starts at bit i*6, possibly straddling two bytes */
+        bits = src[(i * 6) / 8];
+        if ((i * 6) / 8 + 1 < nbytes) {
+            bits |= src[(i * 6) / 8 + 1] << 8;
+        }
+        str[i] = ((bits >> ((i * 6) % 8)) & 0x3f) + 0x20;
+    }
+}
+
+static uint8_t sum_bytes_scalar(const uint8_t *data, int len)
+{
+    uint8_t sum = 0;
+
+    while (len--) {
+        sum += *(data++);
+    }
+
+    return sum;
+}
+
+static int supported_always(void)
+{
+    return 1;
+}
+
+#ifdef FRU_SIMD_X86
+
+/* (c - 0x20) & 0x3f is (c ^ 0x20) & 0x3f, which needs no per-byte borrow
+ * and so works on whole words at once.
+ */
+#define ASCII6_XOR      0x2020202020202020ULL
+#define ASCII6_MASK     0x3f3f3f3f3f3f3f3fULL
+
+/* Packs 16 characters into 12 bytes. The 6-bit values of each group of 4
+ * are merged pairwise into 12 bits by maddubs (c0 + c1 * 64), then into 24
+ * bits by madd (p0 + p1 * 4096), and the low 3 bytes of every 32-bit lane
+ * are gathered by a shuffle.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i pack6_block16(__m128i v)
+{
+    v = _mm_and_si128(_mm_xor_si128(v, _mm_set1_epi8(0x20)),
+                      _mm_set1_epi8(0x3f));
+    v = _mm_maddubs_epi16(v, _mm_set1_epi16(0x4001));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x10000001));
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10,
+                                             12, 13, 14, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+static void pack_ascii6_ssse3(const char *str, int len, uint8_t *dst)
+{
+    __m128i v;
+    int i, j;
+    uint32_t hi;
+
+    for (i = j = 0; i + 16 <= len; i += 16, j += 12) {
+        v = pack6_block16(_mm_loadu_si128((const __m128i *) (str + i)));
+        _mm_storel_epi64((__m128i *) (dst + j), v);
+        hi = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+        memcpy(dst + j + 8, &hi, 4);
+    }
+
+    pack_ascii6_scalar(str + i, len - i, dst + j);
+}
+
+/* The reverse of pack6_block16(): every 3 packed bytes have been shuffled
+ * into a 32-bit lane, the 4 characters in it are moved to their own byte
+ * by shifting each 6-bit field left by 2 bits more than the one before.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i unpack6_block16(__m128i w)
+{
+    __m128i c;
+
+    c = _mm_or_si128(
+            _mm_and_si128(w, _mm_set1_epi32(0x3f)),
+            _mm_and_si128(_mm_slli_epi32(w, 2), _mm_set1_epi32(0x3f00)));
+    c = _mm_or_si128(c,
+            _mm_and_si128(_mm_slli_epi32(w, 4), _mm_set1_epi32(0x3f0000)));
+    c = _mm_or_si128(c,
+            _mm_and_si128(_mm_slli_epi32(w, 6), _mm_set1_epi32(0x3f000000)));
+
+    return _mm_add_epi8(c, _mm_set1_epi8(0x20));
+}
+
+__attribute__((target("ssse3")))
+static void unpack_ascii6_ssse3(const uint8_t *src, int nchars, char *str)
+{
+    __m128i w;
+    uint32_t hi;
+    int i, j;
+
+    for (i = j = 0; i + 16 <= nchars; i += 16, j += 12) {
+        /* exactly 12 bytes are read, there may be nothing past them */
+        memcpy(&hi, src + j + 8, 4);
+        w = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) (src + j)),
+                               _mm_cvtsi32_si128(hi));
+        w = _mm_shuffle_epi8(w, _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                              6, 7, 8, -1, 9, 10, 11, -1));
+        _mm_storeu_si128((__m128i *) (str + i), unpack6_block16(w));
+    }
+
+    unpack_ascii6_scalar(src + j, nchars - i, str + i);
+}
+
+/* 8 characters are 48 bits once their top 2 bits are dropped, which is
+ * exactly what pext does with a 0x3f mask on every byte.
+ */
+__attribute__((target("bmi2")))
+static inline int pack6_pext(const char *str, int len, uint8_t *dst)
+{
+    uint64_t w;
+    int i, j;
+
+    for (i = j = 0; i + 8 <= len; i += 8, j += 6) {
+        memcpy(&w, str + i, 8);
+        w = _pext_u64(w ^ ASCII6_XOR, ASCII6_MASK);
+        /* little endian: the low 6 bytes are the packed ones */
+        memcpy(dst + j, &w, 6);
+    }
+
+    return i;
+}
+
+/* pdep spreads 48 bits back over the low 6 bits of 8 bytes, adding 0x20
+ * to every byte then can't carry into the next one.
+ */
+__attribute__((target("bmi2")))
+static inline int unpack6_pdep(const uint8_t *src, int nchars, char *str)
+{
+    uint64_t w;
+    int i, j;
+
+    for (i = j = 0; i + 8 <= nchars; i += 8, j += 6) {
+        w = 0;
+        memcpy(&w, src + j, 6);
+        w = _pdep_u64(w, ASCII6_MASK) + ASCII6_XOR;
+        memcpy(str + i, &w, 8);
+    }
+
+    return i;
+}
+
+__attribute__((target("bmi2")))
+static void pack_ascii6_bmi2(const char *str, int len, uint8_t *dst)
+{
+    int i = pack6_pext(str, len, dst);
+
+    pack_ascii6_scalar(str + i, len - i, dst + i / 4 * 3);
+}
+
+/* 32 characters per iteration: the steps of pack6_block16() on both
+ * 128-bit lanes, then the 12 packed bytes of each lane are moved next to
+ * each other.
+ */
+__attribute__((target("avx2,bmi2")))
+static void pack_ascii6_avx2(const char *str, int len, uint8_t *dst)
+{
+    __m256i v;
+    int i, j;
+
+    for (i = j = 0; i + 32 <= len; i += 32, j += 24) {
+        v = _mm256_loadu_si256((const __m256i *) (str + i));
+        v = _mm256_and_si256(_mm256_xor_si256(v, _mm256_set1_epi8(0x20)),
+                             _mm256_set1_epi8(0x3f));
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi16(0x4001));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x10000001));
+        v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(
+                0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6,
+                                                             3, 7));
+        _mm_storeu_si128((__m128i *) (dst + j), _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i *) (dst + j + 16),
+                         _mm256_extracti128_si256(v, 1));
+    }
+
+    /* what's left is less than 32 characters, go 8 at a time */
+    i += pack6_pext(str + i, len - i, dst + j);
+
+    pack_ascii6_scalar(str + i, len - i, dst + i / 4 * 3);
+}
+
+__attribute__((target("bmi2")))
+static void unpack_ascii6_bmi2(const uint8_t *src, int nchars, char *str)
+{
+    int i = unpack6_pdep(src, nchars, str);
+
+    unpack_ascii6_scalar(src + i / 4 * 3, nchars - i, str + i);
+}
+
+/* 24 bytes are loaded as two overlapping 16 byte halves, so that the
+ * second 12 bytes start at offset 4 of the upper lane.
+ */
+__attribute__((target("avx2,bmi2")))
+static void unpack_ascii6_avx2(const uint8_t *src, int nchars, char *str)
+{
+    __m256i w, c;
+    int i, j;
+
+    for (i = j = 0; i + 32 <= nchars; i += 32, j += 24) {
+        w = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(
+                    _mm_loadu_si128((const __m128i *) (src + j))),
+                _mm_loadu_si128((const __m128i *) (src + j + 8)), 1);
+        w = _mm256_shuffle_epi8(w, _mm256_setr_epi8(
+                0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1));
+        c = _mm256_or_si256(
+                _mm256_and_si256(w, _mm256_set1_epi32(0x3f)),
+                _mm256_and_si256(_mm256_slli_epi32(w, 2),
+                                 _mm256_set1_epi32(0x3f00)));
+        c = _mm256_or_si256(c,
+                _mm256_and_si256(_mm256_slli_epi32(w, 4),
+                                 _mm256_set1_epi32(0x3f0000)));
+        c = _mm256_or_si256(c,
+                _mm256_and_si256(_mm256_slli_epi32(w, 6),
+                                 _mm256_set1_epi32(0x3f000000)));
+        c = _mm256_add_epi8(c, _mm256_set1_epi8(0x20));
+        _mm256_storeu_si256((__m256i *) (str + i), c);
+    }
+
+    i += unpack6_pdep(src + j, nchars - i, str + i);
+
+    unpack_ascii6_scalar(src + i / 4 * 3, nchars - i, str + i);
+}
+
+/* psadbw against zero adds up 8 bytes into each 64-bit lane. Only the low
+ * 8 bits of the total matter, so the lanes never need to be wider.
+ */
+static uint8_t sum_bytes_sse2(const uint8_t *data, int len)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        acc = _mm_add_epi64(acc,
+                _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (data + i)),
+                             _mm_setzero_si128()));
+    }
+    acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+
+    return _mm_cvtsi128_si32(acc) + sum_bytes_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint8_t sum_bytes_avx2(const uint8_t *data, int len)
+{
+    __m256i acc = _mm256_setzero_si256();
+    __m128i sum;
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        acc = _mm256_add_epi64(acc,
+                _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *) (data + i)),
+                                _mm256_setzero_si256()));
+    }
+    sum = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                        _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
+
+    /* less than 32 bytes left */
+    return _mm_cvtsi128_si32(sum) + sum_bytes_sse2(data + i, len - i);
+}
+
+static int supported_ssse3(void)
+{
+    return __builtin_cpu_supports("ssse3");
+}
+
+static int supported_bmi2(void)
+{
+    return __builtin_cpu_supports("bmi2");
+}
+
+static int supported_avx2(void)
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+}
+
+#endif /* FRU_SIMD_X86 */
+
+/* Every kernel built in, scalar first. Terminated by a NULL name. */
+static const struct fru_kernel fru_kernels[] = {
+    { "scalar", pack_ascii6_scalar, unpack_ascii6_scalar, sum_bytes_scalar,
+      supported_always },
+#ifdef FRU_SIMD_X86
+    /* SSE2 is always there along with SSSE3 or BMI2 */
+    { "ssse3",  pack_ascii6_ssse3,  unpack_ascii6_ssse3,  sum_bytes_sse2,
+      supported_ssse3 },
+    { "bmi2",   pack_ascii6_bmi2,   unpack_ascii6_bmi2,   sum_bytes_sse2,
+      supported_bmi2 },
+    { "avx2",   pack_ascii6_avx2,   unpack_ascii6_avx2,   sum_bytes_avx2,
+      supported_avx2 },
+#endif
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+const struct fru_kernel *fru_kernel = &fru_kernels[0];
+
+/* Runs before main(), so fru_kernel never changes once threads exist */
+__attribute__((constructor))
+static void fru_select_kernel(void)
+{
+    const struct fru_kernel *k;
+
+#ifdef FRU_SIMD_X86
+    __builtin_cpu_init();
+#endif
+
+    /* the table is ordered from slowest to fastest */
+    for (k = fru_kernels; k->name; k++) {
+        if (k->supported()) {
+            fru_kernel = k;
+        }
+    }
+}
+
+#ifdef TESTSIMD
+/* Round-trips random strings through every kernel the CPU supports, and
+ * checks each against the scalar reference, byte sums included. Built and
+ * run by "make check".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NROUNDS 200000
+#define MAXLEN  260
+
+int main(int argc, char *argv[])
+{
+    const struct fru_kernel *k;
+    char str[MAXLEN], out[MAXLEN];
+    uint8_t ref[MAXLEN], packed[MAXLEN];
+    int i, n, len, failed;
+
+    printf("selected kernel: %s\n", fru_kernel->name);
+
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    failed = 0;
+
+    for (n = 0; n < NROUNDS; n++) {
+        len = rand() % MAXLEN;
+        /* every other round uses bytes outside the 6-bit ASCII range,
+         * which must still pack identically
+         */
+        for (i = 0; i < len; i++) {
+            str[i] = n & 1 ? rand() : 0x20 + rand() % 0x40;
+        }
+
+        /* guard bytes catch writes past the packed size */
+        memset(ref, 0xa5, sizeof(ref));
+        pack_ascii6_scalar(str, len, ref);
+
+        for (k = fru_kernels; k->name; k++) {
+            if (!k->supported()) {
+                continue;
+            }
+
+            memset(packed, 0xa5, sizeof(packed));
+            k->pack6(str, len, packed);
+            if (memcmp(packed, ref, sizeof(packed))) {
+                printf("%s: pack differs, length %d\n", k->name, len);
+                failed++;
+            }
+
+            memset(out, 0xa5, sizeof(out));
+            k->unpack6(ref, len, out);
+            for (i = 0; i < len; i++) {
+                if (out[i] != 0x20 + get_6bit_ascii(str[i])) {
+                    break;
+                }
+            }
+            if (i < len || (len < MAXLEN && out[len] != (char) 0xa5)) {
+                printf("%s: unpack differs, length %d\n", k->name, len);
+                failed++;
+            }
+
+            if (k->sum((uint8_t *) str, len) !=
+                sum_bytes_scalar((uint8_t *) str, len)) {
+                printf("%s: sum differs, length %d\n", k->name, len);
+                failed++;
+            }
+        }
+    }
+
+    for (k = fru_kernels; k->name; k++) {
+        printf("%-8s %s\n", k->name,
+               k->supported() ? "tested" : "not supported by this CPU");
+    }
+    printf("%d rounds, %d failures\n", NROUNDS, failed);
+
+    return failed != 0;
+}
+#endif
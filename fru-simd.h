@@ -0,0 +1,63 @@
+#ifndef FRU_SIMD_H
+#define FRU_SIMD_H
+
+#include <inttypes.h>
+
+/*
+ * Vectorized kernels for the hot loops of FRU encoding, with the scalar
+ * versions kept as the reference. The best kernel the CPU supports is picked
+ * once at startup, results are bit-identical whichever one runs.
+ */
+
+static inline uint8_t get_6bit_ascii(char c)
+{
+    return (c - 0x20) & 0x3f;
+}
+
+/* Number of bytes 'len' characters take as 6-bit ASCII */
+static inline int get_ascii6_size(int len)
+{
+    return (len * 6 + 7) / 8;
+}
+
+/* Packs 'len' characters as 6-bit ASCII into get_ascii6_size(len) bytes
+ * of 'dst', 4 characters to 3 bytes, first character in the low bits.
+ */
+typedef void (*fru_pack6_fn)(const char *str, int len, uint8_t *dst);
+
+/* Unpacks 'nchars' 6-bit ASCII characters from the get_ascii6_size(nchars)
+ * bytes at 'src'. No terminating NUL is written.
+ */
+typedef void (*fru_unpack6_fn)(const uint8_t *src, int nchars, char *str);
+
+/* Sum of 'len' bytes, modulo 256 */
+typedef uint8_t (*fru_sum_fn)(const uint8_t *data, int len);
+
+struct fru_kernel {
+    const char      *name;
+    fru_pack6_fn    pack6;
+    fru_unpack6_fn  unpack6;
+    fru_sum_fn      sum;
+    /* non-zero if the CPU can run it */
+    int             (*supported)(void);
+};
+
+/* The kernel selected for this CPU */
+extern const struct fru_kernel *fru_kernel;
+
+static inline void fru_pack6(const char *str, int len, uint8_t *dst)
+{
+    fru_kernel->pack6(str, len, dst);
+}
+
+static inline void fru_unpack6(const uint8_t *src, int nchars, char *str)
+{
+    fru_kernel->unpack6(src, nchars, str);
+}
+
+static inline uint8_t fru_sum(const uint8_t *data, int len)
+{
+    return fru_kernel->sum(data, len);
+}
+
+#endif /* FRU_SIMD_H */
@@ -0,0 +1,3542 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "fru.h"
+#include "fru-defs.h"
+#include "fru-simd.h"
+
+/* Std IPMI FRU Section headers */
+static const char *IUA = "iua";
+
+/* IUA section must-have keys */
+static const char *BINFILE = "bin_file";
+
+/* MultiRecord sections are "mra.0", "mra.1" and so on */
+static const char *MRA = "mra";
+
+/* Info area key of the bytes kept free for later updates */
+static const char *RESERVE = "reserve";
+
+/* Section of per-field encodings, keyed by "section:key" */
+static const char *ENCODING = "encoding";
+
+/* Custom fields that may be shortened or dropped to fit -s */
+static const char *BUDGET_PRIORITY = "budget:priority";
+
+/* predefined keys */
+enum fru_key {
+    KEY_CHASSIS_TYPE,
+    KEY_PART_NUMBER,
+    KEY_SERIAL_NUMBER,
+    KEY_LANGUAGE_CODE,
+    KEY_MFG_DATETIME,
+    KEY_MANUFACTURER,
+    KEY_PRODUCT_NAME,
+    KEY_VERSION,
+    KEY_ASSET_TAG,
+    KEY_FRU_FILE_ID,
+    KEY_CUSTOM
+};
+
+static const char *fru_key_names[] = {
+    [KEY_CHASSIS_TYPE]  = "chassis_type",
+    [KEY_PART_NUMBER]   = "part_number",
+    [KEY_SERIAL_NUMBER] = "serial_number",
+    [KEY_LANGUAGE_CODE] = "language_code",
+    [KEY_MFG_DATETIME]  = "mfg_datetime",
+    [KEY_MANUFACTURER]  = "manufacturer",
+    [KEY_PRODUCT_NAME]  = "product_name",
+    [KEY_VERSION]       = "version",
+    [KEY_ASSET_TAG]     = "asset_tag",
+    [KEY_FRU_FILE_ID]   = "fru_file_id",
+};
+
+/* How a predefined field is stored in its area */
+enum fru_field_kind {
+    FIELD_CHASSIS_TYPE,     /* byte, must not be 0 */
+    FIELD_LANGUAGE_CODE,    /* byte, defaults to English */
+    FIELD_MFG_DATETIME,     /* 3 byte little endian minutes since 1996 */
+    FIELD_STRING,           /* type/length field */
+    FIELD_FILE_ID           /* type/length field, always left empty */
+};
+
+struct fru_field_desc {
+    enum fru_key        key;
+    enum fru_field_kind kind;
+};
+
+/* Layout of an info area: its fixed fields in the order the spec puts
+ * them, followed by the custom fields.
+ */
+struct fru_area_desc {
+    const char                  *section;
+    const char                  *name;
+    /* offset of the area's entry in the common header */
+    size_t                      header_offset;
+    const struct fru_field_desc *fields;
+    int                         num_fields;
+};
+
+static const struct fru_field_desc cia_fields[] = {
+    { KEY_CHASSIS_TYPE,     FIELD_CHASSIS_TYPE },
+    { KEY_PART_NUMBER,      FIELD_STRING },
+    { KEY_SERIAL_NUMBER,    FIELD_STRING },
+};
+
+static const struct fru_field_desc bia_fields[] = {
+    { KEY_LANGUAGE_CODE,    FIELD_LANGUAGE_CODE },
+    { KEY_MFG_DATETIME,     FIELD_MFG_DATETIME },
+    { KEY_MANUFACTURER,     FIELD_STRING },
+    { KEY_PRODUCT_NAME,     FIELD_STRING },
+    { KEY_SERIAL_NUMBER,    FIELD_STRING },
+    { KEY_PART_NUMBER,      FIELD_STRING },
+    { KEY_FRU_FILE_ID,      FIELD_FILE_ID },
+};
+
+static const struct fru_field_desc pia_fields[] = {
+    { KEY_LANGUAGE_CODE,    FIELD_LANGUAGE_CODE },
+    { KEY_MANUFACTURER,     FIELD_STRING },
+    { KEY_PRODUCT_NAME,     FIELD_STRING },
+    { KEY_PART_NUMBER,      FIELD_STRING },
+    { KEY_VERSION,          FIELD_STRING },
+    { KEY_SERIAL_NUMBER,    FIELD_STRING },
+    { KEY_ASSET_TAG,        FIELD_STRING },
+    { KEY_FRU_FILE_ID,      FIELD_FILE_ID },
+};
+
+#define NUM_FIELDS(f)   (sizeof(f) / sizeof((f)[0]))
+
+/* Info areas in the order they are laid out */
+static const struct fru_area_desc fru_areas[NUM_FRU_AREAS] = {
+    { "cia", "Chassis", offsetof(struct fru_common_header, chassis_info_offset),
+      cia_fields, NUM_FIELDS(cia_fields) },
+    { "bia", "Board", offsetof(struct fru_common_header, board_info_offset),
+      bia_fields, NUM_FIELDS(bia_fields) },
+    { "pia", "Product", offsetof(struct fru_common_header, product_info_offset),
+      pia_fields, NUM_FIELDS(pia_fields) },
+};
+
+/* A numeric field of a MultiRecord: 'bits' wide, starting 'shift' bits
+ * into the little endian value at byte 'offset' of the record data.
+ */
+struct mr_field_desc {
+    const char          *key;
+    uint8_t             offset;
+    uint8_t             shift;
+    uint8_t             bits;
+    uint8_t             is_signed;
+    /* names the values may be given by, indexed by value */
+    const char *const   *names;
+    int                 num_names;
+};
+
+/* How the data following the fields of a record is shown when read */
+enum mr_data_kind {
+    MR_DATA_NONE,
+    MR_DATA_HEX,
+    MR_DATA_TEXT            /* unless it has unprintable bytes */
+};
+
+struct mr_type_desc {
+    const char                  *name;
+    uint8_t                     type_id;
+    /* bytes of record data the fields take */
+    int                         length;
+    const struct mr_field_desc  *fields;
+    int                         num_fields;
+    enum mr_data_kind           data;
+};
+
+/* 18.1 Power Supply Information */
+static const struct mr_field_desc mr_power_supply_fields[] = {
+    { "overall_capacity",       0,  0, 12, 0 },
+    { "peak_va",                2,  0, 16, 0 },
+    { "inrush_current",         4,  0,  8, 0 },
+    { "inrush_interval",        5,  0,  8, 0 },
+    { "low_input_voltage_1",    6,  0, 16, 0 },
+    { "high_input_voltage_1",   8,  0, 16, 0 },
+    { "low_input_voltage_2",    10, 0, 16, 0 },
+    { "high_input_voltage_2",   12, 0, 16, 0 },
+    { "low_input_frequency",    14, 0,  8, 0 },
+    { "high_input_frequency",   15, 0,  8, 0 },
+    { "dropout_tolerance",      16, 0,  8, 0 },
+    { "predictive_fail",        17, 0,  1, 0 },
+    { "power_factor_correction", 17, 1, 1, 0 },
+    { "autoswitch",             17, 2,  1, 0 },
+    { "hot_swap",               17, 3,  1, 0 },
+    { "tach_pulse_fail",        17, 4,  1, 0 },
+    { "peak_wattage",           18, 0, 12, 0 },
+    { "holdup_time",            18, 12, 4, 0 },
+    { "combined_voltage_2",     20, 0,  4, 0 },
+    { "combined_voltage_1",     20, 4,  4, 0 },
+    { "combined_wattage",       21, 0, 16, 0 },
+    { "tach_threshold",         23, 0,  8, 0 },
+};
+
+/* 18.2 DC Output */
+static const struct mr_field_desc mr_dc_output_fields[] = {
+    { "output_number",          0,  0,  4, 0 },
+    { "standby",                0,  7,  1, 0 },
+    { "nominal_voltage",        1,  0, 16, 1 },
+    { "max_negative_deviation", 3,  0, 16, 1 },
+    { "max_positive_deviation", 5,  0, 16, 1 },
+    { "ripple_noise",           7,  0, 16, 0 },
+    { "min_current",            9,  0, 16, 0 },
+    { "max_current",            11, 0, 16, 0 },
+};
+
+/* 18.3 DC Load */
+static const struct mr_field_desc mr_dc_load_fields[] = {
+    { "output_number",          0,  0,  4, 0 },
+    { "nominal_voltage",        1,  0, 16, 1 },
+    { "min_voltage",            3,  0, 16, 1 },
+    { "max_voltage",            5,  0, 16, 1 },
+    { "ripple_noise",           7,  0, 16, 0 },
+    { "min_current",            9,  0, 16, 0 },
+    { "max_current",            11, 0, 16, 0 },
+};
+
+/* 18.4 Management Access Record */
+static const char *const mr_access_subtypes[] = {
+    NULL, "system_url", "system_name", "system_ping", "component_url",
+    "component_name", "component_ping", "system_uuid"
+};
+
+static const struct mr_field_desc mr_access_fields[] = {
+    { "subtype",                0,  0,  8, 0, mr_access_subtypes,
+      NUM_FIELDS(mr_access_subtypes) },
+};
+
+/* 18.7 OEM Record */
+static const struct mr_field_desc mr_oem_fields[] = {
+    { "manufacturer_id",        0,  0, 24, 0 },
+};
+
+static const struct mr_type_desc mr_types[] = {
+    { "power_supply", MR_TYPE_POWER_SUPPLY, 24, mr_power_supply_fields,
+      NUM_FIELDS(mr_power_supply_fields), MR_DATA_NONE },
+    { "dc_output", MR_TYPE_DC_OUTPUT, 13, mr_dc_output_fields,
+      NUM_FIELDS(mr_dc_output_fields), MR_DATA_NONE },
+    { "dc_load", MR_TYPE_DC_LOAD, 13, mr_dc_load_fields,
+      NUM_FIELDS(mr_dc_load_fields), MR_DATA_NONE },
+    { "management_access", MR_TYPE_MANAGEMENT_ACCESS, 1, mr_access_fields,
+      NUM_FIELDS(mr_access_fields), MR_DATA_TEXT },
+    { "oem", MR_TYPE_OEM, 3, mr_oem_fields, NUM_FIELDS(mr_oem_fields),
+      MR_DATA_HEX },
+};
+
+/* Any other record type is just data */
+static const struct mr_type_desc mr_generic_type = {
+    NULL, 0, 0, NULL, 0, MR_DATA_HEX
+};
+
+struct fru_arena_chunk {
+    struct fru_arena_chunk  *next;
+    size_t                  size;
+    size_t                  used;
+    uint8_t                 data[];
+};
+
+#define FRU_ARENA_CHUNK_SIZE    16384
+
+static inline int get_aligned_size(int size, int align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+static inline uint8_t get_fru_tl_type(struct fru_type_length *ftl)
+{
+    return ftl->type_length & 0xc0;
+}
+
+static inline uint8_t get_fru_tl_length(struct fru_type_length *ftl)
+{
+    return ftl->type_length & 0x3f;
+}
+
+/* Records why the current call fails, for fru_error(). Returns -1 for the
+ * caller to pass on.
+ */
+__attribute__((format(printf, 2, 3)))
+static int fru_fail(struct fru_gen_ctx *ctx, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(ctx->error, sizeof(ctx->error), fmt, ap);
+    va_end(ap);
+
+    return -1;
+}
+
+/* Passes a message to the context's notify callback. Informational ones
+ * are dropped when the context is quiet.
+ */
+__attribute__((format(printf, 3, 4)))
+static void fru_notify(struct fru_gen_ctx *ctx, int warning,
+                       const char *fmt, ...)
+{
+    char msg[FRU_ERROR_SIZE];
+    va_list ap;
+
+    if (!ctx->notify || (ctx->quiet && !warning)) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    ctx->notify(ctx->notify_arg, warning, msg);
+}
+
+static uint8_t get_zero_cksum(const uint8_t *data, int num_bytes)
+{
+    return -fru_sum(data, num_bytes);
+}
+
+/* Adjusts the zero checksum of an area in which 'old_len' bytes 'old' are
+ * replaced by 'new_len' bytes 'new'. Only the changed bytes are summed,
+ * bytes that merely move within the area don't change the checksum.
+ */
+static uint8_t update_zero_cksum(uint8_t cksum, const uint8_t *old, int old_len,
+                                 const uint8_t *new, int new_len)
+{
+    return cksum + fru_sum(old, old_len) - fru_sum(new, new_len);
+}
+
+/* Returns 'size' bytes, 8-byte aligned, from the arena */
+void *fru_arena_alloc(struct fru_arena *arena, size_t size)
+{
+    struct fru_arena_chunk *chunk, **next;
+    uint8_t *ptr;
+
+    size = (size + 7) & ~(size_t) 7;
+
+    /* use the first chunk with enough room, starting from the current one */
+    chunk = arena->current;
+    while (chunk && chunk->used + size > chunk->size) {
+        chunk = chunk->next;
+    }
+
+    if (!chunk) {
+        chunk = (struct fru_arena_chunk *)
+            malloc(sizeof(*chunk) + (size > FRU_ARENA_CHUNK_SIZE ?
+                                     size : FRU_ARENA_CHUNK_SIZE));
+        if (!chunk) {
+            fprintf(stderr, "\nOut of memory!\n\n");
+            exit(EXIT_FAILURE);
+        }
+        chunk->size = size > FRU_ARENA_CHUNK_SIZE ? size : FRU_ARENA_CHUNK_SIZE;
+        chunk->used = 0;
+        chunk->next = NULL;
+        for (next = &arena->first; *next; next = &(*next)->next)
+            ;
+        *next = chunk;
+    }
+
+    arena->current = chunk;
+    ptr = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return ptr;
+}
+
+void *fru_arena_zalloc(struct fru_arena *arena, size_t size)
+{
+    return memset(fru_arena_alloc(arena, size), 0, size);
+}
+
+/* Releases everything allocated from the arena, keeping its chunks */
+void fru_arena_reset(struct fru_arena *arena)
+{
+    struct fru_arena_chunk *chunk;
+
+    for (chunk = arena->first; chunk; chunk = chunk->next) {
+        chunk->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+void fru_arena_free(struct fru_arena *arena)
+{
+    struct fru_arena_chunk *chunk, *next;
+
+    for (chunk = arena->first; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+static void str_tolower(char *str)
+{
+    for (; *str; str++) {
+        *str = tolower(*str);
+    }
+}
+
+static char *get_string(struct fru_gen_ctx *ctx, const char *key)
+{
+    int i;
+
+    for (i = 0; i < ctx->num_ovr; i++) {
+        if (!strcmp(ctx->ovr_keys[i], key)) {
+            return ctx->ovr_vals[i];
+        }
+    }
+
+    return iniparser_getstring(ctx->ini, key, NULL);
+}
+
+/* Formats a config key into 'buf', or into the arena if it doesn't fit,
+ * so that long section or key names are never cut.
+ */
+static char *format_key(struct fru_gen_ctx *ctx, char *buf, size_t size,
+                        const char *fmt, ...)
+{
+    va_list args;
+    char *key;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(buf, size, fmt, args);
+    va_end(args);
+    if (len < (int) size) {
+        return buf;
+    }
+
+    key = (char *) fru_arena_alloc(ctx->arena, len + 1);
+    va_start(args, fmt);
+    vsnprintf(key, len + 1, fmt, args);
+    va_end(args);
+
+    return key;
+}
+
+/* Looks up "section:key", allocating the combined key only if it is long */
+static char *get_field(struct fru_gen_ctx *ctx, const char *section,
+                       const char *key)
+{
+    char concat[64];
+
+    return get_string(ctx, format_key(ctx, concat, sizeof(concat), "%s:%s",
+                                      section, key));
+}
+
+static int get_field_int(struct fru_gen_ctx *ctx, const char *section,
+                         const char *key, int notfound)
+{
+    char *str = get_field(ctx, section, key);
+
+    if (!str) {
+        return notfound;
+    }
+
+    return (int) strtol(str, NULL, 0);
+}
+
+/* Packers write a type/length field to 'dst' and return its size in bytes,
+ * -1 if the string needs more than the 63 bytes a type/length field can
+ * hold or -2 if it has characters the encoding can't represent. With a
+ * NULL 'dst' they only return the size.
+ */
+static int pack_ascii6(const char *str, uint8_t *dst)
+{
+    struct fru_type_length *ftl;
+    int len, size;
+
+    len = strlen(str);
+
+    /* 6-bit ASCII packed allocates 6 bits per char */
+    int numbytes = get_ascii6_size(len);
+    if (numbytes > 0x3f) {
+        return -1;
+    }
+
+    size = numbytes + sizeof(struct fru_type_length);
+    if (!dst) {
+        return size;
+    }
+
+    ftl = (struct fru_type_length *) dst;
+    ftl->type_length = TYPE_CODE_ASCII6 | numbytes;
+
+    fru_pack6(str, len, ftl->data);
+
+    return size;
+}
+
+static int pack_ascii8(const char *str, uint8_t *dst)
+{
+    struct fru_type_length *ftl;
+    int len, size;
+
+    len = strlen(str);
+    if (len > 0x3f) {
+        return -1;
+    }
+
+    /* A 1 character Latin-1 field would read 0xc1, the end marker. Use
+     * 6-bit ASCII, which takes as much space, when the character allows.
+     */
+    if (len == 1) {
+        return *str >= 0x20 && *str < 0x60 ? pack_ascii6(str, dst) : -2;
+    }
+
+    size = len + sizeof(struct fru_type_length);
+    if (!dst) {
+        return size;
+    }
+
+    ftl = (struct fru_type_length *) dst;
+    ftl->type_length = TYPE_CODE_UNILATIN | len;
+    memcpy(ftl->data, str, len);
+
+    return size;
+}
+
+/* BCD plus holds 2 characters per byte, the first one in the high nibble */
+static const char bcdplus_chars[] = "0123456789 -.";
+
+static inline int get_bcdplus_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    switch (c) {
+        case ' ': return 0xa;
+        case '-': return 0xb;
+        case '.': return 0xc;
+        default:  return -1;
+    }
+}
+
+static int pack_bcdplus(const char *str, uint8_t *dst)
+{
+    struct fru_type_length *ftl;
+    int len, numbytes, digit, i;
+
+    len = strlen(str);
+    numbytes = (len + 1) / 2;
+    if (numbytes > 0x3f) {
+        return -1;
+    }
+
+    ftl = (struct fru_type_length *) dst;
+    if (dst) {
+        ftl->type_length = TYPE_CODE_BCDPLUS | numbytes;
+    }
+
+    for (i = 0; i < len; i++) {
+        if ((digit = get_bcdplus_digit(str[i])) < 0) {
+            return -2;
+        }
+        if (!dst) {
+            continue;
+        }
+        if (i % 2) {
+            ftl->data[i / 2] = (ftl->data[i / 2] & 0xf0) | digit;
+        } else {
+            /* an odd length is padded with a space */
+            ftl->data[i / 2] = (digit << 4) | 0xa;
+        }
+    }
+
+    return numbytes + sizeof(struct fru_type_length);
+}
+
+static inline int get_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* Binary values are given as hex digits, 2 per byte */
+static int pack_binary(const char *str, uint8_t *dst)
+{
+    struct fru_type_length *ftl;
+    int len, numbytes, hi, lo, i;
+
+    len = strlen(str);
+    if (len % 2) {
+        return -2;
+    }
+
+    numbytes = len / 2;
+    if (numbytes > 0x3f) {
+        return -1;
+    }
+
+    ftl = (struct fru_type_length *) dst;
+    if (dst) {
+        ftl->type_length = TYPE_CODE_BINARY | numbytes;
+    }
+
+    for (i = 0; i < numbytes; i++) {
+        hi = get_hex_digit(str[2 * i]);
+        lo = get_hex_digit(str[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return -2;
+        }
+        if (dst) {
+            ftl->data[i] = (hi << 4) | lo;
+        }
+    }
+
+    return numbytes + sizeof(struct fru_type_length);
+}
+
+/* Stores the bytes of 'str' as they are in a binary field */
+static int pack_raw(const char *str, uint8_t *dst)
+{
+    struct fru_type_length *ftl;
+    int len;
+
+    len = strlen(str);
+    if (len > 0x3f) {
+        return -1;
+    }
+
+    if (dst) {
+        ftl = (struct fru_type_length *) dst;
+        ftl->type_length = TYPE_CODE_BINARY | len;
+        memcpy(ftl->data, str, len);
+    }
+
+    return len + sizeof(struct fru_type_length);
+}
+
+/* Picks the smallest encoding that can hold 'str' as it is, out of BCD
+ * plus, 6-bit ASCII, Latin-1 and binary, from a single scan of the string.
+ * Ties go to the encoding listed first. Binary only wins for a single
+ * character 6-bit ASCII can't represent, which Latin-1 can't store.
+ */
+static int (*plan_encoding(const char *str))(const char *, uint8_t *)
+{
+    const unsigned char *c;
+    int bcdplus_ok, ascii6_ok;
+
+    bcdplus_ok = ascii6_ok = 1;
+    for (c = (const unsigned char *) str; *c; c++) {
+        if (get_bcdplus_digit(*c) < 0) {
+            bcdplus_ok = 0;
+        }
+        if (*c < 0x20 || *c >= 0x60) {
+            ascii6_ok = 0;
+        }
+    }
+
+    /* BCD plus is never larger than 6-bit ASCII, which is never larger
+     * than Latin-1
+     */
+    if (bcdplus_ok) {
+        return pack_bcdplus;
+    } else if (ascii6_ok) {
+        return pack_ascii6;
+    } else if (c - (const unsigned char *) str != 1) {
+        return pack_ascii8;
+    }
+
+    return pack_raw;
+}
+
+static int pack_auto(const char *str, uint8_t *dst)
+{
+    return plan_encoding(str)(str, dst);
+}
+
+/* The first entry is the default encoding */
+static const struct fru_encoding fru_encodings[] = {
+    { "ascii6",     pack_ascii6 },
+    { "ascii8",     pack_ascii8 },
+    { "latin1",     pack_ascii8 },
+    { "bcdplus",    pack_bcdplus },
+    { "binary",     pack_binary },
+    { "auto",       pack_auto },
+    { NULL,         NULL }
+};
+
+/* What pack_auto() uses for single characters, not selectable by name */
+static const struct fru_encoding raw_encoding = { "binary", pack_raw };
+
+static const struct fru_encoding *find_encoding(const char *name)
+{
+    const struct fru_encoding *enc;
+
+    for (enc = fru_encodings; enc->name; enc++) {
+        if (!strcmp(enc->name, name)) {
+            return enc;
+        }
+    }
+
+    return NULL;
+}
+
+void fru_ctx_init(struct fru_gen_ctx *ctx, dictionary *ini)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->ini = ini;
+    ctx->encoding = &fru_encodings[0];
+    ctx->arena = &ctx->own_arena;
+}
+
+/* Frees the context's own arena and cache, the config is the caller's */
+void fru_ctx_release(struct fru_gen_ctx *ctx)
+{
+    fru_arena_free(&ctx->own_arena);
+    free(ctx->cache);
+    ctx->cache = NULL;
+}
+
+const char *fru_error(const struct fru_gen_ctx *ctx)
+{
+    return ctx->error;
+}
+
+int fru_set_encoding(struct fru_gen_ctx *ctx, const char *name)
+{
+    const struct fru_encoding *enc;
+
+    if (!(enc = find_encoding(name))) {
+        return fru_fail(ctx, "Unknown encoding %s", name);
+    }
+    ctx->encoding = enc;
+
+    return 0;
+}
+
+/* Packed type/length fields remembered by encoding and string. The cache
+ * is direct mapped, a value evicts whatever its hash lands on, so it never
+ * holds more than FRU_CACHE_ENTRIES values.
+ */
+#define FRU_CACHE_ENTRIES   256
+
+struct fru_cache_entry {
+    const struct fru_encoding   *enc;       /* NULL if unused */
+    uint32_t                    hash;
+    uint8_t                     len;        /* of 'str' */
+    uint8_t                     size;       /* of 'data' */
+    /* no encoding can pack a longer string */
+    char                        str[128];
+    /* a type/length byte and up to 63 bytes */
+    uint8_t                     data[64];
+};
+
+struct fru_pack_cache {
+    struct fru_cache_entry      entries[FRU_CACHE_ENTRIES];
+};
+
+int fru_cache_enable(struct fru_gen_ctx *ctx)
+{
+    if (!ctx->cache &&
+        !(ctx->cache = (struct fru_pack_cache *)
+              calloc(1, sizeof(struct fru_pack_cache)))) {
+        return fru_fail(ctx, "Out of memory!");
+    }
+
+    return 0;
+}
+
+/* Packs 'str' like enc->pack(), through the context's cache if it has
+ * one. A miss packs the whole field even when only the size is asked for,
+ * since the field is usually encoded right after its size is known.
+ */
+static int pack_cached(struct fru_gen_ctx *ctx,
+                       const struct fru_encoding *enc, const char *str,
+                       uint8_t *dst)
+{
+    struct fru_cache_entry *e;
+    uint32_t hash;
+    size_t len;
+    int size;
+
+    if (!ctx->cache) {
+        return enc->pack(str, dst);
+    }
+
+    /* FNV-1a of the string, seeded with the encoding */
+    hash = 2166136261u ^ (uint32_t) (uintptr_t) enc;
+    for (len = 0; str[len]; len++) {
+        hash = (hash ^ (uint8_t) str[len]) * 16777619u;
+    }
+
+    e = &ctx->cache->entries[hash % FRU_CACHE_ENTRIES];
+    if (len >= sizeof(e->str)) {
+        return enc->pack(str, dst);
+    }
+
+    if (e->enc == enc && e->hash == hash && e->len == len &&
+        !memcmp(e->str, str, len)) {
+        ctx->cache_hits++;
+    } else {
+        ctx->cache_misses++;
+        if ((size = enc->pack(str, e->data)) < 0) {
+            e->enc = NULL;
+            return size;
+        }
+        e->enc = enc;
+        e->hash = hash;
+        e->len = len;
+        e->size = size;
+        memcpy(e->str, str, len);
+    }
+
+    if (dst) {
+        memcpy(dst, e->data, e->size);
+    }
+
+    return e->size;
+}
+
+/* Returns the encoding of "section:key", as set by the [encoding] section
+ * or else the default one. NULL if the section names an unknown one.
+ */
+static const struct fru_encoding *get_encoding(struct fru_gen_ctx *ctx,
+                                               const char *section,
+                                               const char *key, int *pinned)
+{
+    const struct fru_encoding *enc;
+    char concat[80];
+    char *name;
+
+    name = iniparser_getstring(ctx->ini,
+                               format_key(ctx, concat, sizeof(concat),
+                                          "%s:%s:%s", ENCODING, section,
+                                          key), NULL);
+    *pinned = name != NULL;
+    if (!name) {
+        return ctx->encoding;
+    }
+
+    if (!(enc = find_encoding(name))) {
+        fru_fail(ctx, "Unknown encoding %s for %s:%s", name, section, key);
+    }
+
+    return enc;
+}
+
+/* Maps a key name to its enum fru_key, KEY_CUSTOM if it isn't predefined.
+ * The first two characters tell the predefined keys apart, so a single
+ * strcmp() confirms the match.
+ */
+static enum fru_key lookup_key(const char *name)
+{
+    enum fru_key key;
+
+    switch (name[0]) {
+        case 'a': key = KEY_ASSET_TAG; break;
+        case 'c': key = KEY_CHASSIS_TYPE; break;
+        case 'f': key = KEY_FRU_FILE_ID; break;
+        case 'l': key = KEY_LANGUAGE_CODE; break;
+        case 'm':
+            key = name[1] == 'f' ? KEY_MFG_DATETIME : KEY_MANUFACTURER;
+            break;
+        case 'p':
+            key = name[1] == 'a' ? KEY_PART_NUMBER : KEY_PRODUCT_NAME;
+            break;
+        case 's': key = KEY_SERIAL_NUMBER; break;
+        case 'v': key = KEY_VERSION; break;
+        default: return KEY_CUSTOM;
+    }
+
+    return strcmp(name, fru_key_names[key]) ? KEY_CUSTOM : key;
+}
+
+static int area_has_key(const struct fru_area_desc *area, enum fru_key key)
+{
+    int i;
+
+    for (i = 0; i < area->num_fields; i++) {
+        if (area->fields[i].key == key) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Adds a type/length field to the area, NULL 'value' being an empty one.
+ * Empty fields take 1 byte (for type/length).
+ */
+static int add_area_value(struct fru_gen_ctx *ctx, struct fru_area_layout *al,
+                          const char *section, const char *key,
+                          const char *value, int custom)
+{
+    struct fru_area_value *v = &al->values[al->num_values++];
+    int size = 1;
+
+    v->key = key;
+    v->str = value;
+    v->enc = NULL;
+    v->pinned = 0;
+    v->custom = custom;
+
+    if (value) {
+        v->enc = get_encoding(ctx, section, key, &v->pinned);
+        if (!v->enc) {
+            return -1;
+        }
+        size = pack_cached(ctx, v->enc, value, NULL);
+        if (size == -1) {
+            return fru_fail(ctx, "%s:%s is too long for a FRU field",
+                            section, key);
+        } else if (size < 0) {
+            return fru_fail(ctx, "%s:%s can't be encoded as %s", section,
+                            key, v->enc->name);
+        }
+    }
+
+    v->size = size;
+    al->used += size;
+
+    return 0;
+}
+
+/* Gathers the values of a chassis, board or product info area and works
+ * out its size. Predefined fields keep their place even when empty, custom
+ * fields with no data are left out.
+ */
+static int layout_info_area(struct fru_gen_ctx *ctx,
+                            const struct fru_area_desc *area,
+                            struct fru_area_layout *al)
+{
+    const struct fru_field_desc *field;
+    const char *key;
+    char **sec_keys, *str_data;
+    int i, value, num_keys, seclen;
+
+    num_keys = iniparser_getsecnkeys(ctx->ini, area->section);
+
+    memset(al, 0, sizeof(*al));
+    al->desc = area;
+    al->values = (struct fru_area_value *)
+        fru_arena_alloc(ctx->arena, (area->num_fields + num_keys) *
+                                    sizeof(struct fru_area_value));
+    /* format version and area length */
+    al->used = 2;
+
+    for (i = 0; i < area->num_fields; i++) {
+        field = &area->fields[i];
+        key = fru_key_names[field->key];
+
+        switch (field->kind) {
+            case FIELD_CHASSIS_TYPE:
+                value = get_field_int(ctx, area->section, key, 0);
+                if (!value) {
+                    /* 0 is an illegal chassis type */
+                    return fru_fail(ctx, "Invalid chassis type! Aborting");
+                }
+                al->fixed[al->num_fixed++] = value;
+                break;
+            case FIELD_LANGUAGE_CODE:
+                value = get_field_int(ctx, area->section, key, -1);
+                if (value == -1) {
+                    fru_notify(ctx, 0, "%s language code not specified. "
+                               "Defaulting to English", area->name);
+                    value = 0;
+                }
+                al->fixed[al->num_fixed++] = value;
+                break;
+            case FIELD_MFG_DATETIME:
+                value = get_field_int(ctx, area->section, key, -1);
+                if (value == -1) {
+                    fru_notify(ctx, 0, "Manufacturing time not specified. "
+                               "Defaulting to unspecified");
+                    value = 0;
+                }
+                /* little endian */
+                al->fixed[al->num_fixed++] = value;
+                al->fixed[al->num_fixed++] = value >> 8;
+                al->fixed[al->num_fixed++] = value >> 16;
+                break;
+            case FIELD_STRING:
+                str_data = get_field(ctx, area->section, key);
+                if (str_data && !strlen(str_data)) {
+                    str_data = NULL;
+                }
+                if (add_area_value(ctx, al, area->section, key, str_data, 0)) {
+                    return -1;
+                }
+                break;
+            case FIELD_FILE_ID:
+                /* We don't handle FRU File ID for now... */
+                add_area_value(ctx, al, area->section, key, NULL, 0);
+                break;
+        }
+    }
+
+    sec_keys = iniparser_getseckeys(ctx->ini, area->section);
+    seclen = strlen(area->section);
+
+    for (i = 0; i < num_keys; i++) {
+        /* keys are "section:key", match on the part after the colon */
+        key = sec_keys[i] + seclen + 1;
+        if (area_has_key(area, lookup_key(key)) || !strcmp(key, RESERVE)) {
+            continue;
+        }
+        str_data = get_string(ctx, sec_keys[i]);
+        if (str_data && strlen(str_data) &&
+            add_area_value(ctx, al, area->section, key, str_data, 1)) {
+            free(sec_keys);
+            return -1;
+        }
+    }
+
+    free(sec_keys);
+
+    al->reserve = get_field_int(ctx, area->section, RESERVE, 0);
+    if (al->reserve < 0 || al->reserve > 0xff * 8) {
+        return fru_fail(ctx, "Invalid %s:%s", area->section, RESERVE);
+    }
+
+    /* end marker and checksum, padded to a multiple of 8 bytes */
+    al->used += al->num_fixed + 2;
+    al->size = get_aligned_size(al->used + al->reserve, 8);
+    if (al->size > 0xff * 8) {
+        return fru_fail(ctx, "%s area exceeds %d bytes", area->section,
+                        0xff * 8);
+    }
+
+    return 0;
+}
+
+/* Stores the low 'bits' bits of 'value' at bit 'pos' of 'data', least
+ * significant bit first
+ */
+static void put_bits(uint8_t *data, int pos, int bits, unsigned long value)
+{
+    for (; bits--; pos++, value >>= 1) {
+        if (value & 1) {
+            data[pos / 8] |= 1 << (pos % 8);
+        } else {
+            data[pos / 8] &= ~(1 << (pos % 8));
+        }
+    }
+}
+
+static unsigned long get_bits(const uint8_t *data, int pos, int bits)
+{
+    unsigned long value = 0;
+    int i;
+
+    for (i = 0; i < bits; i++, pos++) {
+        value |= (unsigned long) ((data[pos / 8] >> (pos % 8)) & 1) << i;
+    }
+
+    return value;
+}
+
+/* Parses the value of a MultiRecord field, which may also be given by
+ * name. Returns -1 if it's not a valid value for the field.
+ */
+static int parse_mr_field(const struct mr_field_desc *field, const char *str,
+                          long *value)
+{
+    char *end;
+    long limit;
+    int i;
+
+    for (i = 0; i < field->num_names; i++) {
+        if (field->names[i] && !strcmp(field->names[i], str)) {
+            *value = i;
+            return 0;
+        }
+    }
+
+    errno = 0;
+    *value = strtol(str, &end, 0);
+    if (end == str || *end || errno) {
+        return -1;
+    }
+
+    limit = 1L << (field->bits - field->is_signed);
+    if (*value >= limit || *value < (field->is_signed ? -limit : 0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Looks a record type up by name or type ID. Every OEM type ID maps to the
+ * OEM record, unknown type IDs to a record of plain data.
+ */
+static const struct mr_type_desc *find_mr_type(const char *name,
+                                               uint8_t *type_id)
+{
+    char *end;
+    long id;
+    int i;
+
+    for (i = 0; i < NUM_FIELDS(mr_types); i++) {
+        if (!strcmp(mr_types[i].name, name)) {
+            *type_id = mr_types[i].type_id;
+            return &mr_types[i];
+        }
+    }
+
+    id = strtol(name, &end, 0);
+    if (end == name || *end || id < 0 || id > 0xff) {
+        return NULL;
+    }
+    *type_id = id;
+
+    for (i = 0; i < NUM_FIELDS(mr_types); i++) {
+        if (mr_types[i].type_id == id ||
+            (mr_types[i].type_id == MR_TYPE_OEM && id >= MR_TYPE_OEM)) {
+            return &mr_types[i];
+        }
+    }
+
+    return &mr_generic_type;
+}
+
+/* Finds the [mra.N] sections, numbered from 0 up, and sizes their records */
+static int layout_multirecords(struct fru_gen_ctx *ctx,
+                               struct fru_layout *layout)
+{
+    const struct mr_field_desc *field;
+    struct mr_record_layout *r;
+    char section[16], *str;
+    long value;
+    int n, i, data_len;
+
+    for (n = 0; ; n++) {
+        snprintf(section, sizeof(section), "%s.%d", MRA, n);
+        if (!iniparser_find_entry(ctx->ini, section)) {
+            break;
+        }
+    }
+    if (!n) {
+        return 0;
+    }
+
+    layout->num_records = n;
+    layout->records = (struct mr_record_layout *)
+        fru_arena_zalloc(ctx->arena, n * sizeof(struct mr_record_layout));
+
+    for (n = 0; n < layout->num_records; n++) {
+        r = &layout->records[n];
+        snprintf(section, sizeof(section), "%s.%d", MRA, n);
+        r->section = strcpy((char *) fru_arena_alloc(ctx->arena,
+                                                     strlen(section) + 1),
+                            section);
+
+        str = get_field(ctx, section, "type");
+        if (!str) {
+            return fru_fail(ctx, "%s:type not found!", section);
+        }
+        if (!(r->type = find_mr_type(str, &r->type_id))) {
+            return fru_fail(ctx, "Unknown MultiRecord type %s in %s", str,
+                            section);
+        }
+
+        for (i = 0; i < r->type->num_fields; i++) {
+            field = &r->type->fields[i];
+            str = get_field(ctx, section, field->key);
+            if (str && parse_mr_field(field, str, &value)) {
+                return fru_fail(ctx, "Invalid value %s for %s:%s", str,
+                                section, field->key);
+            }
+        }
+
+        data_len = 0;
+        if ((r->data = get_field(ctx, section, "data"))) {
+            data_len = strlen(r->data);
+        } else if ((r->data = get_field(ctx, section, "data_hex"))) {
+            r->data_hex = 1;
+            data_len = strlen(r->data) / 2;
+            for (i = 0; r->data[i]; i++) {
+                if (get_hex_digit(r->data[i]) < 0) {
+                    break;
+                }
+            }
+            if (r->data[i] || i % 2) {
+                return fru_fail(ctx, "%s:data_hex must be pairs of hex "
+                                "digits", section);
+            }
+        }
+
+        r->length = r->type->length + data_len;
+        if (r->length > 0xff) {
+            return fru_fail(ctx, "%s record data exceeds %d bytes", section,
+                            0xff);
+        }
+
+        layout->mra_size += sizeof(struct multirecord_header) + r->length;
+    }
+
+    layout->mra_size = get_aligned_size(layout->mra_size, 8);
+
+    return 0;
+}
+
+/* Places the info areas one after the other, following the IUA, and then
+ * the MultiRecord area
+ */
+static int place_areas(struct fru_gen_ctx *ctx, struct fru_layout *layout)
+{
+    struct fru_area_layout *al;
+    int offset, i;
+
+    offset = sizeof(struct fru_common_header) + layout->iua_size;
+
+    for (i = 0; i < NUM_FRU_AREAS; i++) {
+        al = &layout->areas[i];
+        if (!al->desc) {
+            continue;
+        }
+        /* the common header holds offsets in multiples of 8 bytes */
+        if (offset > 0xff * 8) {
+            return fru_fail(ctx, "%s area starts beyond %d bytes",
+                            al->desc->section, 0xff * 8);
+        }
+        al->offset = offset;
+        offset += al->size;
+    }
+
+    /* the MultiRecord area comes last */
+    if (layout->num_records) {
+        if (offset > 0xff * 8) {
+            return fru_fail(ctx, "%s area starts beyond %d bytes", MRA,
+                            0xff * 8);
+        }
+        layout->mra_offset = offset;
+        offset += layout->mra_size;
+    }
+
+    layout->length = offset;
+
+    return 0;
+}
+
+/* Works out where every area goes. Nothing is encoded yet, so the image
+ * can be written straight to its final place by encode_fru_data().
+ */
+int fru_layout_data(struct fru_gen_ctx *ctx, struct fru_layout *layout)
+{
+    struct stat st;
+    int offset, i;
+
+    memset(layout, 0, sizeof(*layout));
+
+    /* A common header always exists even if there's no FRU data */
+    offset = sizeof(struct fru_common_header);
+
+    /* "Internal Use Area" (IUA) section */
+    if (iniparser_find_entry(ctx->ini, IUA)) {
+        /* We expect this section to have a single key - "binfile", with a
+         * value of the absolute path to the binary file to write to in the
+         * IUA
+         */
+        layout->iua_file = get_field(ctx, IUA, BINFILE);
+        if (!layout->iua_file) {
+            return fru_fail(ctx, "%s:%s not found!", IUA, BINFILE);
+        }
+        if (stat(layout->iua_file, &st)) {
+            return fru_fail(ctx, "Unable to open %s for reading!",
+                            layout->iua_file);
+        }
+        layout->iua_data_size = st.st_size;
+        layout->iua_size = get_aligned_size(sizeof(struct internal_use_area) +
+                                            st.st_size, 8);
+        layout->iua_offset = offset;
+        offset += layout->iua_size;
+    }
+
+    /* Chassis, board and product info area sections */
+    for (i = 0; i < NUM_FRU_AREAS; i++) {
+        if (iniparser_find_entry(ctx->ini, fru_areas[i].section) &&
+            layout_info_area(ctx, &fru_areas[i], &layout->areas[i])) {
+            return -1;
+        }
+    }
+
+    if (layout_multirecords(ctx, layout)) {
+        return -1;
+    }
+
+    return place_areas(ctx, layout);
+}
+
+/* Changes the encoded size of one field, and with it the size of its area */
+static void resize_area_value(struct fru_area_layout *al,
+                              struct fru_area_value *v, int size)
+{
+    al->used += size - v->size;
+    al->size = get_aligned_size(al->used + al->reserve, 8);
+    v->size = size;
+}
+
+/* Returns the encoding 'pack' belongs to, for reporting */
+static const struct fru_encoding *get_pack_encoding(int (*pack)(const char *,
+                                                                uint8_t *))
+{
+    const struct fru_encoding *enc;
+
+    for (enc = fru_encodings; enc->name; enc++) {
+        if (enc->pack == pack) {
+            return enc;
+        }
+    }
+
+    return &raw_encoding;
+}
+
+static struct fru_area_value *find_custom_value(struct fru_area_layout *al,
+                                                const char *key)
+{
+    int i;
+
+    for (i = 0; i < al->num_values; i++) {
+        if (al->values[i].custom && al->values[i].size &&
+            !strcmp(al->values[i].key, key)) {
+            return &al->values[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Shortens or drops the custom fields of the [budget] priority list, first
+ * entry first, until the image fits in 'max_size' bytes. Entries are
+ * "section:key" to drop a field or "section:key:N" to cut it to N
+ * characters.
+ */
+static void fit_budget_priority(struct fru_gen_ctx *ctx,
+                                struct fru_layout *layout, int max_size)
+{
+    struct fru_area_layout *al;
+    struct fru_area_value *v;
+    char *list, *entry, *key, *len_str, *str, *saveptr;
+    int i, len, size;
+
+    list = get_string(ctx, BUDGET_PRIORITY);
+    if (!list) {
+        return;
+    }
+    list = strcpy((char *) fru_arena_alloc(ctx->arena, strlen(list) + 1),
+                  list);
+
+    for (entry = strtok_r(list, ", \t", &saveptr);
+         entry && layout->length > max_size;
+         entry = strtok_r(NULL, ", \t", &saveptr)) {
+        str_tolower(entry);
+        if (!(key = strchr(entry, ':'))) {
+            fru_notify(ctx, 1, "Ignoring %s entry %s, expected section:key",
+                       BUDGET_PRIORITY, entry);
+            continue;
+        }
+        *key++ = '\0';
+        len = -1;
+        if ((len_str = strchr(key, ':'))) {
+            *len_str++ = '\0';
+            len = atoi(len_str);
+        }
+
+        v = NULL;
+        for (i = 0; i < NUM_FRU_AREAS && !v; i++) {
+            al = &layout->areas[i];
+            if (al->desc && !strcmp(al->desc->section, entry)) {
+                v = find_custom_value(al, key);
+            }
+        }
+        if (!v) {
+            continue;
+        }
+
+        if (len < 0) {
+            fru_notify(ctx, 0, "Dropped %s:%s, saving %d byte%s", entry, key,
+                       v->size, v->size == 1 ? "" : "s");
+            v->str = NULL;
+            resize_area_value(al, v, 0);
+        } else if (len > 0 && len < (int) strlen(v->str)) {
+            str = (char *) fru_arena_alloc(ctx->arena, len + 1);
+            memcpy(str, v->str, len);
+            str[len] = '\0';
+            /* a cut binary value may be left with half a byte */
+            if ((size = v->enc->pack(str, NULL)) < 0) {
+                continue;
+            }
+            fru_notify(ctx, 0, "Shortened %s:%s to %d characters, saving "
+                       "%d byte%s", entry, key, len, v->size - size,
+                       v->size - size == 1 ? "" : "s");
+            v->str = str;
+            resize_area_value(al, v, size);
+        }
+        /* areas only move up, which can't fail */
+        place_areas(ctx, layout);
+    }
+}
+
+/* Brings the image within 'max_size' bytes if it's larger. Reasons from
+ * the encoded sizes only, nothing is encoded until the layout fits: text
+ * fields whose encoding isn't set in the [encoding] section are moved to
+ * the smallest encoding that holds them, one at a time until the image
+ * fits, then the [budget] priority list is applied. Every change is
+ * reported. Returns 0 if the image fits.
+ */
+int fru_fit_layout(struct fru_gen_ctx *ctx, struct fru_layout *layout,
+                   int max_size)
+{
+    const struct fru_encoding *enc;
+    struct fru_area_layout *al;
+    struct fru_area_value *v;
+    int i, j, size;
+
+    if (layout->length <= max_size) {
+        return 0;
+    }
+
+    for (i = 0; i < NUM_FRU_AREAS && layout->length > max_size; i++) {
+        al = &layout->areas[i];
+        for (j = 0; al->desc && j < al->num_values &&
+                    layout->length > max_size; j++) {
+            v = &al->values[j];
+            /* binary values are hex digits, not text */
+            if (!v->str || v->pinned || v->enc->pack == pack_binary) {
+                continue;
+            }
+            enc = get_pack_encoding(plan_encoding(v->str));
+            size = enc->pack(v->str, NULL);
+            if (size >= v->size) {
+                continue;
+            }
+            fru_notify(ctx, 0, "Encoded %s:%s as %s, saving %d byte%s",
+                       al->desc->section, v->key, enc->name, v->size - size,
+                       v->size - size == 1 ? "" : "s");
+            v->enc = enc;
+            resize_area_value(al, v, size);
+            /* areas only move up, which can't fail */
+            place_areas(ctx, layout);
+        }
+    }
+
+    fit_budget_priority(ctx, layout, max_size);
+
+    if (layout->length > max_size) {
+        return fru_fail(ctx, "FRU data length (%d bytes) exceeds maximum "
+                        "file size (%d bytes)", layout->length, max_size);
+    }
+
+    fru_notify(ctx, 0, "FRU data fits in %d of %d bytes", layout->length,
+               max_size);
+
+    return 0;
+}
+
+static int encode_iua(struct fru_gen_ctx *ctx, const struct fru_layout *layout,
+                      uint8_t *dst)
+{
+    struct internal_use_area *iua;
+    int fd, result, size;
+
+    /* Write format version */
+    iua = (struct internal_use_area *) dst;
+    iua->format_version = 0x01;
+
+    if ((fd = open(layout->iua_file, O_RDONLY)) == -1) {
+        return fru_fail(ctx, "Unable to open %s for reading!",
+                        layout->iua_file);
+    }
+
+    result = read(fd, iua->data, layout->iua_data_size);
+    close(fd);
+    if (result != layout->iua_data_size) {
+        return fru_fail(ctx, "Error reading entire file content!");
+    }
+
+    size = sizeof(struct internal_use_area) + layout->iua_data_size;
+    memset(dst + size, 0, layout->iua_size - size);
+
+    return 0;
+}
+
+static void encode_info_area(struct fru_gen_ctx *ctx,
+                             const struct fru_area_layout *al, uint8_t *dst)
+{
+    uint8_t *p = dst;
+    int i;
+
+    *p++ = 0x01;
+    /* Length is in multiples of 8 bytes */
+    *p++ = al->size / 8;
+
+    memcpy(p, al->fixed, al->num_fixed);
+    p += al->num_fixed;
+
+    for (i = 0; i < al->num_values; i++) {
+        if (al->values[i].str) {
+            p += pack_cached(ctx, al->values[i].enc, al->values[i].str, p);
+        } else if (al->values[i].size) {
+            *p++ = 0;
+        }
+    }
+
+    *p++ = 0xc1;
+    memset(p, 0, dst + al->size - 1 - p);
+    dst[al->size - 1] = get_zero_cksum(dst, al->size - 1);
+}
+
+static void encode_multirecords(struct fru_gen_ctx *ctx,
+                                const struct fru_layout *layout, uint8_t *dst)
+{
+    const struct mr_record_layout *r;
+    const struct mr_field_desc *field;
+    struct multirecord_header *hdr;
+    uint8_t *p, *data, *var;
+    const char *str;
+    long value;
+    int n, i;
+
+    p = dst;
+
+    for (n = 0; n < layout->num_records; n++) {
+        r = &layout->records[n];
+        hdr = (struct multirecord_header *) p;
+        data = p + sizeof(*hdr);
+
+        /* fields not given are 0 */
+        memset(data, 0, r->type->length);
+        for (i = 0; i < r->type->num_fields; i++) {
+            field = &r->type->fields[i];
+            str = get_field(ctx, r->section, field->key);
+            if (str && !parse_mr_field(field, str, &value)) {
+                put_bits(data, field->offset * 8 + field->shift, field->bits,
+                         value);
+            }
+        }
+
+        var = data + r->type->length;
+        if (r->data_hex) {
+            for (i = 0; i < r->length - r->type->length; i++) {
+                var[i] = (get_hex_digit(r->data[2 * i]) << 4) |
+                         get_hex_digit(r->data[2 * i + 1]);
+            }
+        } else if (r->data) {
+            memcpy(var, r->data, r->length - r->type->length);
+        }
+
+        hdr->type_id = r->type_id;
+        hdr->format = MR_FORMAT_VERSION;
+        if (n == layout->num_records - 1) {
+            hdr->format |= MR_END_OF_LIST;
+        }
+        hdr->length = r->length;
+        hdr->record_checksum = get_zero_cksum(data, r->length);
+        hdr->header_checksum = get_zero_cksum(p, sizeof(*hdr) - 1);
+
+        p = data + r->length;
+    }
+
+    memset(p, 0, dst + layout->mra_size - p);
+}
+
+/* Encodes the image laid out by fru_layout_data() into 'data', which must
+ * hold layout->length bytes.
+ */
+static int encode_fru_data(struct fru_gen_ctx *ctx,
+                           const struct fru_layout *layout, uint8_t *data)
+{
+    struct fru_common_header *fch;
+    const struct fru_area_layout *al;
+    int i;
+
+    fch = (struct fru_common_header *) data;
+    memset(fch, 0, sizeof(*fch));
+    fch->format_version = 0x01;
+
+    if (layout->iua_file) {
+        fch->internal_use_offset = layout->iua_offset / 8;
+        if (encode_iua(ctx, layout, data + layout->iua_offset)) {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < NUM_FRU_AREAS; i++) {
+        al = &layout->areas[i];
+        if (al->desc) {
+            data[al->desc->header_offset] = al->offset / 8;
+            encode_info_area(ctx, al, data + al->offset);
+        }
+    }
+
+    if (layout->num_records) {
+        fch->multirecord_info_offset = layout->mra_offset / 8;
+        encode_multirecords(ctx, layout, data + layout->mra_offset);
+    }
+
+    /* calculate header checksum */
+    fch->checksum = get_zero_cksum(data, sizeof(*fch) - 1);
+
+    return 0;
+}
+
+/* The FRU data, like everything else generated, lives in ctx->arena and
+ * stays valid until the arena is reset.
+ */
+int fru_encode(struct fru_gen_ctx *ctx, uint8_t **data)
+{
+    struct fru_layout layout;
+
+    if (fru_layout_data(ctx, &layout) ||
+        (ctx->max_size && fru_fit_layout(ctx, &layout, ctx->max_size))) {
+        return -1;
+    }
+
+    *data = (uint8_t *) fru_arena_alloc(ctx->arena, layout.length);
+    if (encode_fru_data(ctx, &layout, *data)) {
+        return -1;
+    }
+
+    return layout.length;
+}
+
+/* Generates FRU data from 'fields' alone, as if they were the whole config */
+int fru_encode_fields(struct fru_gen_ctx *ctx,
+                      const struct fru_field_value *fields, int num_fields,
+                      uint8_t **data)
+{
+    dictionary *ini, *saved_ini;
+    char buf[64], *entry;
+    int result, i;
+
+    if (!(ini = dictionary_new(0))) {
+        return fru_fail(ctx, "Out of memory!");
+    }
+
+    for (i = 0; i < num_fields; i++) {
+        entry = format_key(ctx, buf, sizeof(buf), "%s:%s", fields[i].section,
+                           fields[i].key);
+        /* sections are entries of their own */
+        if (iniparser_set(ini, fields[i].section, NULL) ||
+            iniparser_set(ini, entry, fields[i].value)) {
+            dictionary_del(ini);
+            return fru_fail(ctx, "Out of memory!");
+        }
+    }
+
+    saved_ini = ctx->ini;
+    ctx->ini = ini;
+    result = fru_encode(ctx, data);
+    ctx->ini = saved_ini;
+
+    dictionary_del(ini);
+
+    return result;
+}
+
+/* pread()/pwrite()/write() all of 'len' bytes, at 'offset' for the first
+ * two, retrying when interrupted. Reads stop early at the end of the file
+ * and return the number of bytes transferred.
+ */
+static ssize_t pread_full(int fd, uint8_t *buf, size_t len, off_t offset)
+{
+    ssize_t result;
+    size_t done;
+
+    for (done = 0; done < len; done += result) {
+        result = pread(fd, buf + done, len - done, offset + done);
+        if (result < 0 && errno == EINTR) {
+            result = 0;
+        } else if (result < 0) {
+            return -1;
+        } else if (!result) {
+            break;
+        }
+    }
+
+    return done;
+}
+
+static ssize_t pwrite_full(int fd, const uint8_t *buf, size_t len, off_t offset)
+{
+    ssize_t result;
+    size_t done;
+
+    for (done = 0; done < len; done += result) {
+        result = pwrite(fd, buf + done, len - done, offset + done);
+        if (result < 0 && errno == EINTR) {
+            result = 0;
+        } else if (result < 0) {
+            return -1;
+        }
+    }
+
+    return done;
+}
+
+static ssize_t write_full(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t result;
+    size_t done;
+
+    for (done = 0; done < len; done += result) {
+        result = write(fd, buf + done, len - done);
+        if (result < 0 && errno == EINTR) {
+            result = 0;
+        } else if (result < 0) {
+            return -1;
+        }
+    }
+
+    return done;
+}
+
+/* Encodes the FRU data straight into 'filename', which is sized and mapped
+ * up front. Outputs that can't be mapped, like pipes, are written from a
+ * buffer instead.
+ */
+int fru_write_data(struct fru_gen_ctx *ctx, const struct fru_layout *layout,
+                   const char *filename)
+{
+    int fd, flags, result;
+    uint8_t *data;
+    mode_t mode;
+
+    fd = -1;
+    flags = O_RDWR | O_CREAT | O_TRUNC;
+    mode = S_IRWXU | S_IRGRP | S_IROTH;
+
+    if ((fd = open(filename, flags, mode)) == -1) {
+        return fru_fail(ctx, "Error writing %s: %s", filename,
+                        strerror(errno));
+    }
+
+    data = MAP_FAILED;
+    if (!ftruncate(fd, layout->length)) {
+        data = (uint8_t *) mmap(NULL, layout->length, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    }
+
+    if (data != MAP_FAILED) {
+        result = encode_fru_data(ctx, layout, data);
+        if (munmap(data, layout->length) && !result) {
+            result = fru_fail(ctx, "Error writing %s: %s", filename,
+                              strerror(errno));
+        }
+    } else {
+        data = (uint8_t *) fru_arena_alloc(ctx->arena, layout->length);
+        result = encode_fru_data(ctx, layout, data);
+        if (!result && write_full(fd, data, layout->length) < 0) {
+            result = fru_fail(ctx, "Error writing %s: %s", filename,
+                              strerror(errno));
+        }
+    }
+
+    if (close(fd) && !result) {
+        result = fru_fail(ctx, "Error writing %s: %s", filename,
+                          strerror(errno));
+    }
+
+    return result;
+}
+
+/* Programs the FRU data into 'device', an EEPROM node or a regular file,
+ * rewriting only the 'page_size' pages whose contents differ and reading
+ * everything back afterwards. Bytes of the device past the FRU data are
+ * left alone. Data read back that doesn't match fails with EIO.
+ */
+int fru_program_device(struct fru_gen_ctx *ctx,
+                       const struct fru_layout *layout, const char *device,
+                       int page_size)
+{
+    uint8_t *data, *current;
+    int fd, result, saved_errno, num_pages, num_written, n;
+    ssize_t have;
+    off_t offset;
+
+    if (page_size < 1) {
+        return fru_fail(ctx, "Invalid page size %d for %s", page_size,
+                        device);
+    }
+
+    data = (uint8_t *) fru_arena_alloc(ctx->arena, layout->length);
+    current = (uint8_t *) fru_arena_alloc(ctx->arena, layout->length);
+    if (encode_fru_data(ctx, layout, data)) {
+        return -1;
+    }
+
+    if ((fd = open(device, O_RDWR)) == -1) {
+        return fru_fail(ctx, "Error programming %s: %s", device,
+                        strerror(errno));
+    }
+
+    result = -1;
+    num_pages = num_written = 0;
+
+    /* a short device or file reads as changed pages */
+    have = pread_full(fd, current, layout->length, 0);
+    if (have < 0) {
+        goto out;
+    }
+
+    for (offset = 0; offset < layout->length; offset += page_size) {
+        n = layout->length - offset < page_size ?
+            layout->length - offset : page_size;
+        num_pages++;
+        if (offset + n <= have && !memcmp(current + offset, data + offset, n)) {
+            continue;
+        }
+        if (pwrite_full(fd, data + offset, n, offset) < 0) {
+            goto out;
+        }
+        num_written++;
+    }
+
+    if (num_written && fsync(fd) && errno != EINVAL) {
+        goto out;
+    }
+
+    have = pread_full(fd, current, layout->length, 0);
+    if (have < 0) {
+        goto out;
+    }
+    if (have != layout->length || memcmp(current, data, layout->length)) {
+        errno = EIO;
+        goto out;
+    }
+
+    result = 0;
+    fru_notify(ctx, 0, "Wrote %d of %d pages of %d bytes", num_written,
+               num_pages, page_size);
+
+out:
+    saved_errno = errno;
+    if (close(fd) && !result) {
+        saved_errno = errno;
+        result = -1;
+    }
+    if (result) {
+        return fru_fail(ctx, "Error programming %s: %s", device,
+                        strerror(saved_errno));
+    }
+
+    return 0;
+}
+
+/* A compiled template file: this header, 'num_slots' slots and then the
+ * FRU image at 'image_offset'. Values are stored in host byte order, the
+ * file is only meant for the machine that compiled it.
+ */
+#define FRU_TEMPLATE_MAGIC      "FRUT"
+#define FRU_TEMPLATE_VERSION    2
+#define FRU_TEMPLATE_ORDER      0x0102
+#define FRU_SLOT_NAME_SIZE      48
+
+struct fru_template_header {
+    char        magic[4];
+    uint8_t     version;
+    uint8_t     num_slots;
+    uint16_t    byte_order;
+    uint32_t    image_offset;
+    /* of the image with the config values in the slots */
+    uint32_t    image_length;
+    /* of the image with every slot full */
+    uint32_t    max_length;
+    /* per info area, 0 if it has no slot */
+    uint16_t    end_offset[NUM_FRU_AREAS];  /* of the end of fields marker */
+    uint16_t    reserve[NUM_FRU_AREAS];
+    /* sum of the area up to its end marker, without length and slots */
+    uint8_t     partial_sum[NUM_FRU_AREAS];
+    uint8_t     pad[5];
+};
+
+/* A field whose value is filled in for each unit. Slots are sorted by
+ * offset. The image holds the config value of the field; a unit gets its
+ * own value packed in its place, and the rest of the area, the areas after
+ * it and the common header are moved and summed to match.
+ */
+struct fru_template_slot {
+    /* "section:key", or the name of a placeholder, NUL terminated. The
+     * same placeholder can fill several fields.
+     */
+    char        key[FRU_SLOT_NAME_SIZE];
+    uint16_t    offset;         /* of the type/length byte in the image */
+    uint8_t     area;
+    uint8_t     encoding;       /* index in fru_encodings */
+    uint8_t     capacity;       /* in characters */
+    uint8_t     size;           /* of the config value, type/length included */
+    uint8_t     custom;         /* left out rather than empty without value */
+    uint8_t     pad;
+};
+
+/* Fields filled in for each unit, "section:key" or "section:key:N" for
+ * values of up to N characters
+ */
+static const char *TEMPLATE_SLOTS = "template:slots";
+
+/* Longest slot value, 63 bytes of BCD plus */
+#define FRU_SLOT_MAX        126
+/* Capacity of a placeholder that doesn't give one */
+#define FRU_SLOT_DEFAULT    32
+
+/* Parses a "${name}" or "${name:N}" config value into the placeholder
+ * name, lower cased, and its capacity. Returns 1 if 'str' is one, 0 if it
+ * is a plain value and -1 if it starts like a placeholder but isn't one.
+ */
+static int parse_placeholder(const char *str, char *name, size_t name_size,
+                             int *capacity)
+{
+    char *end;
+    size_t len;
+
+    if (strncmp(str, "${", 2)) {
+        return 0;
+    }
+    str += 2;
+
+    len = strcspn(str, ":}");
+    if (!len || len >= name_size) {
+        return -1;
+    }
+    end = (char *) str + len;
+
+    *capacity = FRU_SLOT_DEFAULT;
+    if (*end == ':') {
+        *capacity = strtol(end + 1, &end, 10);
+    }
+    if (*end != '}' || *(end + 1)) {
+        return -1;
+    }
+
+    memcpy(name, str, len);
+    name[len] = '\0';
+    str_tolower(name);
+
+    return 1;
+}
+
+/* Writes to 'buf' the value of 'capacity' characters that takes the most
+ * bytes in 'enc', which the template is laid out for: any character in the
+ * fixed width encodings, one that 6-bit ASCII can't hold for the others.
+ * A single character takes 2 bytes whatever it is.
+ */
+static void longest_slot_value(const struct fru_encoding *enc, int capacity,
+                               char *buf)
+{
+    char c = capacity > 1 ? 'a' : 'A';
+
+    if (enc->pack == pack_ascii6) {
+        c = ' ';
+    } else if (enc->pack == pack_bcdplus || enc->pack == pack_binary) {
+        c = '0';
+    }
+    /* binary values are whole bytes */
+    if (enc->pack == pack_binary) {
+        capacity &= ~1;
+    }
+
+    memset(buf, c, capacity);
+    buf[capacity] = '\0';
+}
+
+static int write_fru_image(struct fru_gen_ctx *ctx, const char *filename,
+                           const void *data, size_t length)
+{
+    int fd, result;
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC,
+              S_IRWXU | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        return fru_fail(ctx, "Error writing %s: %s", filename,
+                        strerror(errno));
+    }
+
+    result = 0;
+    if (write_full(fd, (const uint8_t *) data, length) < 0) {
+        result = fru_fail(ctx, "Error writing %s: %s", filename,
+                          strerror(errno));
+    }
+
+    if (close(fd) && !result) {
+        result = fru_fail(ctx, "Error writing %s: %s", filename,
+                          strerror(errno));
+    }
+
+    return result;
+}
+
+/* Checks that "section:key" of 'area' is a text field that can be a slot */
+static int check_slot_field(struct fru_gen_ctx *ctx,
+                            const struct fru_area_desc *area, const char *key,
+                            const char *entry)
+{
+    enum fru_key fkey = lookup_key(key);
+    int i;
+
+    if (!strcmp(key, RESERVE) ||
+        (fkey != KEY_CUSTOM && !area_has_key(area, fkey))) {
+        return fru_fail(ctx, "%s can't be a slot, only text fields of the "
+                        "cia, bia and pia areas can", entry);
+    }
+    for (i = 0; i < area->num_fields; i++) {
+        if (area->fields[i].key == fkey &&
+            area->fields[i].kind != FIELD_STRING) {
+            return fru_fail(ctx, "%s can't be a slot, only text fields of "
+                            "the cia, bia and pia areas can", entry);
+        }
+    }
+
+    return 0;
+}
+
+/* Adds a slot for field 'field' ("section:key") of area 'area'. Returns
+ * the new number of slots.
+ */
+static int add_template_slot(struct fru_gen_ctx *ctx,
+                             struct fru_template_slot *slots, char **fields,
+                             int num_slots, const char *key,
+                             const char *field, int area, int capacity)
+{
+    int i;
+
+    if (num_slots == 0xff) {
+        return fru_fail(ctx, "More than %d slots", 0xff);
+    }
+    if (strlen(key) >= sizeof(slots->key)) {
+        return fru_fail(ctx, "Slot name %s is too long", key);
+    }
+    for (i = 0; i < num_slots; i++) {
+        if (!strcmp(fields[i], field)) {
+            return fru_fail(ctx, "%s is a slot twice", field);
+        }
+    }
+
+    memset(&slots[num_slots], 0, sizeof(slots[num_slots]));
+    strcpy(slots[num_slots].key, key);
+    slots[num_slots].area = area;
+    slots[num_slots].capacity = capacity;
+    fields[num_slots] = strcpy((char *) fru_arena_alloc(ctx->arena,
+                                                        strlen(field) + 1),
+                               field);
+
+    return num_slots + 1;
+}
+
+/* Gathers the slots of the config into 'slots', keys and capacities only:
+ * the fields listed in the [template] section, then the placeholders.
+ * 'fields' gets the "section:key" each slot fills. Returns the number of
+ * slots.
+ */
+static int parse_template_slots(struct fru_gen_ctx *ctx,
+                                struct fru_template_slot *slots,
+                                char **fields)
+{
+    const struct fru_area_desc *area;
+    char *list, *entry, *key, *len_str, *str, *saveptr, **sec_keys;
+    char name[FRU_SLOT_NAME_SIZE];
+    int num_slots, num_keys, len, result, i, j;
+
+    num_slots = 0;
+
+    list = get_string(ctx, TEMPLATE_SLOTS);
+    if (list) {
+        list = strcpy((char *) fru_arena_alloc(ctx->arena, strlen(list) + 1),
+                      list);
+    }
+
+    for (entry = list ? strtok_r(list, ", \t", &saveptr) : NULL; entry;
+         entry = strtok_r(NULL, ", \t", &saveptr)) {
+        str_tolower(entry);
+        if (!(key = strchr(entry, ':'))) {
+            return fru_fail(ctx, "Invalid %s entry %s, expected section:key",
+                            TEMPLATE_SLOTS, entry);
+        }
+        len = -1;
+        if ((len_str = strchr(key + 1, ':'))) {
+            *len_str++ = '\0';
+            len = atoi(len_str);
+        }
+
+        area = NULL;
+        for (i = 0; i < NUM_FRU_AREAS; i++) {
+            if (!strncmp(fru_areas[i].section, entry, key - entry) &&
+                !fru_areas[i].section[key - entry]) {
+                area = &fru_areas[i];
+            }
+        }
+        if (!area) {
+            return fru_fail(ctx, "%s can't be a slot, only text fields of "
+                            "the cia, bia and pia areas can", entry);
+        }
+        if (check_slot_field(ctx, area, key + 1, entry)) {
+            return -1;
+        }
+        if (!iniparser_find_entry(ctx->ini, area->section)) {
+            return fru_fail(ctx, "%s is in a section the config doesn't "
+                            "have", entry);
+        }
+
+        /* without a capacity, the config value is as long as it gets */
+        str = get_string(ctx, entry);
+        if (len < 0) {
+            len = str ? strlen(str) : 0;
+        }
+        if (len < 1 || len > FRU_SLOT_MAX) {
+            return fru_fail(ctx, "Invalid capacity for slot %s", entry);
+        }
+        if (str && (int) strlen(str) > len) {
+            return fru_fail(ctx, "%s is longer than its slot", entry);
+        }
+
+        /* keys the config doesn't have become custom fields */
+        if (!str) {
+            iniparser_set(ctx->ini, entry, "");
+        }
+
+        num_slots = add_template_slot(ctx, slots, fields, num_slots, entry,
+                                      entry, area - fru_areas, len);
+        if (num_slots < 0) {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < NUM_FRU_AREAS; i++) {
+        area = &fru_areas[i];
+        num_keys = iniparser_getsecnkeys(ctx->ini, area->section);
+        sec_keys = iniparser_getseckeys(ctx->ini, area->section);
+        for (j = 0; j < num_keys; j++) {
+            str = get_string(ctx, sec_keys[j]);
+            result = str ? parse_placeholder(str, name, sizeof(name), &len)
+                         : 0;
+            if (result < 0 || (result && (len < 1 || len > FRU_SLOT_MAX))) {
+                result = fru_fail(ctx, "Invalid placeholder %s for %s", str,
+                                  sec_keys[j]);
+            } else if (result) {
+                key = sec_keys[j] + strlen(area->section) + 1;
+                if (check_slot_field(ctx, area, key, sec_keys[j])) {
+                    result = -1;
+                } else {
+                    num_slots = add_template_slot(ctx, slots, fields,
+                                                  num_slots, name,
+                                                  sec_keys[j], i, len);
+                    result = num_slots < 0 ? -1 : 0;
+                }
+            }
+            if (result) {
+                free(sec_keys);
+                return -1;
+            }
+        }
+        free(sec_keys);
+    }
+
+    if (!num_slots) {
+        return fru_fail(ctx, "The config has no %s and no placeholders",
+                        TEMPLATE_SLOTS);
+    }
+
+    return num_slots;
+}
+
+/* Returns 1 if a value of an info area is a "${name}" placeholder */
+int fru_has_placeholders(struct fru_gen_ctx *ctx)
+{
+    char **sec_keys, *str, name[FRU_SLOT_NAME_SIZE];
+    int num_keys, found, capacity, i, j;
+
+    found = 0;
+    for (i = 0; i < NUM_FRU_AREAS && !found; i++) {
+        num_keys = iniparser_getsecnkeys(ctx->ini, fru_areas[i].section);
+        sec_keys = iniparser_getseckeys(ctx->ini, fru_areas[i].section);
+        for (j = 0; j < num_keys && !found; j++) {
+            str = get_string(ctx, sec_keys[j]);
+            /* a broken one counts, compiling reports it */
+            found = str && parse_placeholder(str, name, sizeof(name),
+                                             &capacity);
+        }
+        free(sec_keys);
+    }
+
+    return found;
+}
+
+/* Builds a template from the config into a malloc()ed buffer: the FRU
+ * image with the config value in every slot, where each slot is, and the
+ * sum of each area without its slots. The constant fields are encoded and
+ * summed here once, filling the template only packs the slots.
+ *
+ * The image is first laid out with every slot full, which checks that the
+ * longest values fit and is what -s is applied to. The config values then
+ * take their place, at the size fru_layout_data() gives them.
+ */
+static int build_template(struct fru_gen_ctx *ctx, uint8_t **file,
+                          size_t *file_size)
+{
+    struct fru_template_header *hdr;
+    struct fru_template_slot *slots, *sorted;
+    struct fru_area_layout *al;
+    struct fru_area_value *v, **slot_values;
+    struct fru_layout layout;
+    const struct fru_encoding *enc;
+    char **saved_keys, **saved_vals, **fields, **vals, **defaults;
+    char *section, *key, *str;
+    int saved_num, num_slots, num_sorted, pinned, offset, size, result;
+    int i, j, s;
+    uint8_t *image, sum;
+
+    slots = (struct fru_template_slot *)
+        fru_arena_alloc(ctx->arena, 0xff * sizeof(*slots));
+    fields = (char **) fru_arena_alloc(ctx->arena, 0xff * sizeof(char *));
+    if ((num_slots = parse_template_slots(ctx, slots, fields)) < 0) {
+        return -1;
+    }
+
+    vals = (char **) fru_arena_alloc(ctx->arena, num_slots * sizeof(char *));
+    defaults = (char **) fru_arena_alloc(ctx->arena,
+                                         num_slots * sizeof(char *));
+    slot_values = (struct fru_area_value **)
+        fru_arena_zalloc(ctx->arena, num_slots * sizeof(*slot_values));
+    for (s = 0; s < num_slots; s++) {
+        section = strcpy((char *) fru_arena_alloc(ctx->arena,
+                                                  strlen(fields[s]) + 1),
+                         fields[s]);
+        key = strchr(section, ':');
+        *key++ = '\0';
+        enc = get_encoding(ctx, section, key, &pinned);
+        if (!enc) {
+            return -1;
+        }
+        slots[s].encoding = enc - fru_encodings;
+        slots[s].custom = !area_has_key(&fru_areas[slots[s].area],
+                                        lookup_key(key));
+
+        vals[s] = (char *) fru_arena_alloc(ctx->arena, FRU_SLOT_MAX + 1);
+        longest_slot_value(enc, slots[s].capacity, vals[s]);
+        size = *vals[s] ? enc->pack(vals[s], NULL) : -2;
+        if (size < 0) {
+            return fru_fail(ctx, "Slot %s can't hold %d characters as %s",
+                            slots[s].key, slots[s].capacity, enc->name);
+        }
+
+        /* placeholders have no config value */
+        str = get_string(ctx, fields[s]);
+        defaults[s] = str && !strcmp(slots[s].key, fields[s]) ? str : "";
+    }
+
+    saved_keys = ctx->ovr_keys;
+    saved_vals = ctx->ovr_vals;
+    saved_num = ctx->num_ovr;
+    ctx->ovr_keys = fields;
+    ctx->ovr_vals = vals;
+    ctx->num_ovr = num_slots;
+
+    result = fru_layout_data(ctx, &layout);
+
+    /* pin the slots to their encoding, so fitting -s leaves them alone */
+    for (i = 0; !result && i < NUM_FRU_AREAS; i++) {
+        al = &layout.areas[i];
+        for (j = 0; al->desc && j < al->num_values; j++) {
+            for (s = 0; s < num_slots; s++) {
+                if (al->values[j].str == vals[s]) {
+                    slot_values[s] = &al->values[j];
+                    al->values[j].pinned = 1;
+                }
+            }
+        }
+    }
+    if (!result && ctx->max_size) {
+        result = fru_fit_layout(ctx, &layout, ctx->max_size);
+    }
+
+    ctx->ovr_keys = saved_keys;
+    ctx->ovr_vals = saved_vals;
+    ctx->num_ovr = saved_num;
+
+    if (result) {
+        return -1;
+    }
+
+    /* the longest image the slots can make, then the config values */
+    size = layout.length;
+    for (s = 0; s < num_slots; s++) {
+        v = slot_values[s];
+        if (!v || v->str != vals[s]) {
+            return fru_fail(ctx, "Slot %s was cut or dropped to fit -s",
+                            slots[s].key);
+        }
+        al = &layout.areas[slots[s].area];
+        enc = &fru_encodings[slots[s].encoding];
+        if (*defaults[s]) {
+            if ((i = enc->pack(defaults[s], NULL)) < 0) {
+                return fru_fail(ctx, "%s can't be encoded as %s", fields[s],
+                                enc->name);
+            }
+            v->str = defaults[s];
+            resize_area_value(al, v, i);
+        } else {
+            /* as layout_info_area() leaves out an empty value */
+            v->str = NULL;
+            resize_area_value(al, v, slots[s].custom ? 0 : 1);
+        }
+    }
+    /* areas only move up, which can't fail */
+    place_areas(ctx, &layout);
+
+    i = get_aligned_size(sizeof(*hdr) + num_slots * sizeof(*slots), 8);
+    *file_size = i + layout.length;
+    if (!(*file = (uint8_t *) calloc(1, *file_size))) {
+        return fru_fail(ctx, "Out of memory!");
+    }
+    image = *file + i;
+    if (encode_fru_data(ctx, &layout, image)) {
+        free(*file);
+        return -1;
+    }
+
+    hdr = (struct fru_template_header *) *file;
+    memcpy(hdr->magic, FRU_TEMPLATE_MAGIC, sizeof(hdr->magic));
+    hdr->version = FRU_TEMPLATE_VERSION;
+    hdr->num_slots = num_slots;
+    hdr->byte_order = FRU_TEMPLATE_ORDER;
+    hdr->image_offset = i;
+    hdr->image_length = layout.length;
+    hdr->max_length = size;
+
+    /* find the slots by walking the fields as encode_info_area() wrote
+     * them, which also puts them in image order
+     */
+    sorted = (struct fru_template_slot *) (hdr + 1);
+    num_sorted = 0;
+    for (i = 0; i < NUM_FRU_AREAS; i++) {
+        al = &layout.areas[i];
+        if (!al->desc) {
+            continue;
+        }
+        offset = al->offset + 2 + al->num_fixed;
+        sum = 0;
+        for (j = 0; j < al->num_values; j++) {
+            v = &al->values[j];
+            for (s = 0; s < num_slots; s++) {
+                if (slot_values[s] == v) {
+                    slots[s].offset = offset;
+                    slots[s].size = v->size;
+                    sorted[num_sorted++] = slots[s];
+                    sum += fru_sum(image + offset, v->size);
+                }
+            }
+            offset += v->size;
+        }
+        if (num_sorted && sorted[num_sorted - 1].area == i) {
+            hdr->end_offset[i] = offset;
+            hdr->reserve[i] = al->reserve;
+            /* the length byte is worked out again too */
+            hdr->partial_sum[i] = fru_sum(image + al->offset,
+                                          offset + 1 - al->offset) -
+                                  image[al->offset + 1] - sum;
+        }
+    }
+
+    return 0;
+}
+
+/* Points 'tmpl' at the template in 'data' after checking it, in place */
+static int check_template(struct fru_gen_ctx *ctx, const char *name,
+                          const uint8_t *data, size_t size,
+                          struct fru_template *tmpl)
+{
+    const struct fru_template_header *hdr;
+    const struct fru_template_slot *slot;
+    const uint8_t *image;
+    int start[NUM_FRU_AREAS];
+    int prev, i;
+
+    hdr = (const struct fru_template_header *) data;
+    tmpl->hdr = hdr;
+    if (size < sizeof(*hdr)) {
+        return fru_fail(ctx, "%s is not a FRU template", name);
+    }
+    tmpl->slots = (const struct fru_template_slot *) (hdr + 1);
+    tmpl->image = image = data + hdr->image_offset;
+
+    if (memcmp(hdr->magic, FRU_TEMPLATE_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != FRU_TEMPLATE_VERSION ||
+        hdr->byte_order != FRU_TEMPLATE_ORDER ||
+        hdr->image_offset < sizeof(*hdr) + hdr->num_slots * sizeof(*slot) ||
+        hdr->image_offset > size ||
+        hdr->image_length > size - hdr->image_offset ||
+        hdr->image_length < sizeof(struct fru_common_header) ||
+        hdr->max_length < hdr->image_length) {
+        return fru_fail(ctx, "%s is not a FRU template", name);
+    }
+
+    /* areas with slots: fields, end marker, then padding and checksum */
+    prev = 0;
+    for (i = 0; i < NUM_FRU_AREAS; i++) {
+        start[i] = image[fru_areas[i].header_offset] * 8;
+        if (!hdr->end_offset[i]) {
+            continue;
+        }
+        if (start[i] <= prev || start[i] + 2 > hdr->end_offset[i] ||
+            hdr->end_offset[i] >= hdr->image_length ||
+            hdr->end_offset[i] + 1 >= start[i] + image[start[i] + 1] * 8 ||
+            start[i] + image[start[i] + 1] * 8 > (int) hdr->image_length) {
+            return fru_fail(ctx, "%s is not a FRU template", name);
+        }
+        prev = hdr->end_offset[i];
+    }
+
+    prev = 0;
+    for (i = 0; i < hdr->num_slots; i++) {
+        slot = &tmpl->slots[i];
+        if (slot->key[sizeof(slot->key) - 1] || slot->area >= NUM_FRU_AREAS ||
+            !hdr->end_offset[slot->area] ||
+            /* any encoding but the NULL end of the list */
+            slot->encoding >= NUM_FIELDS(fru_encodings) - 1 ||
+            slot->capacity > FRU_SLOT_MAX ||
+            slot->offset < prev || slot->offset < start[slot->area] + 2 ||
+            slot->offset + slot->size > hdr->end_offset[slot->area]) {
+            return fru_fail(ctx, "%s is not a FRU template", name);
+        }
+        prev = slot->offset + slot->size;
+    }
+
+    return 0;
+}
+
+/* Compiles the config into a template written to 'filename' */
+int fru_compile(struct fru_gen_ctx *ctx, const char *filename)
+{
+    uint8_t *file;
+    size_t size;
+    int result;
+
+    if (build_template(ctx, &file, &size)) {
+        return -1;
+    }
+
+    result = write_fru_image(ctx, filename, file, size);
+    free(file);
+
+    return result;
+}
+
+/* Compiles the config into a template kept in memory, for generating
+ * several units from a config with placeholders
+ */
+int fru_template_compile(struct fru_gen_ctx *ctx, struct fru_template *tmpl)
+{
+    uint8_t *file;
+    size_t size;
+
+    if (build_template(ctx, &file, &size)) {
+        return -1;
+    }
+
+    tmpl->map_size = 0;
+    /* can't fail on what was just built */
+    check_template(ctx, "config", file, size, tmpl);
+
+    return 0;
+}
+
+/* Maps a template compiled by fru_compile(). This is the whole of loading
+ * it: the header and slots are checked in place, nothing is parsed or
+ * allocated.
+ */
+int fru_template_open(struct fru_gen_ctx *ctx, const char *filename,
+                      struct fru_template *tmpl)
+{
+    struct stat st;
+    void *addr;
+    int fd, saved_errno;
+
+    if ((fd = open(filename, O_RDONLY)) == -1 || fstat(fd, &st)) {
+        saved_errno = errno;
+        if (fd != -1) {
+            close(fd);
+        }
+        return fru_fail(ctx, "%s: %s", filename, strerror(saved_errno));
+    }
+    if (!st.st_size) {
+        close(fd);
+        return fru_fail(ctx, "%s is not a FRU template", filename);
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return fru_fail(ctx, "%s: %s", filename, strerror(errno));
+    }
+
+    tmpl->map_size = st.st_size;
+    if (check_template(ctx, filename, (const uint8_t *) addr, st.st_size,
+                       tmpl)) {
+        fru_template_close(tmpl);
+        return -1;
+    }
+
+    return 0;
+}
+
+void fru_template_close(struct fru_template *tmpl)
+{
+    if (tmpl->map_size) {
+        munmap((void *) tmpl->hdr, tmpl->map_size);
+    } else {
+        free((void *) tmpl->hdr);
+    }
+    tmpl->hdr = NULL;
+}
+
+int fru_template_length(const struct fru_template *tmpl)
+{
+    return tmpl->hdr->max_length;
+}
+
+/* Returns the index of the first slot named 'key', -1 if the template has
+ * none
+ */
+int fru_template_find_slot(const struct fru_template *tmpl, const char *key)
+{
+    int i;
+
+    for (i = 0; i < tmpl->hdr->num_slots; i++) {
+        if (!strcmp(tmpl->slots[i].key, key)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Writes the template image to 'dst', which must hold
+ * fru_template_length() bytes, with the slots given in the context's
+ * overrides packed in. Other slots keep their config value. The image is
+ * copied piecewise around the slots: each area with slots gets its length,
+ * padding and checksum worked out again from the slots alone, and what
+ * follows it moves with it. The result is what fru_layout_data() makes
+ * of the same values. Returns the image length.
+ */
+int fru_template_fill(struct fru_gen_ctx *ctx,
+                      const struct fru_template *tmpl, uint8_t *dst)
+{
+    const struct fru_template_header *hdr = tmpl->hdr;
+    const struct fru_template_slot *slot;
+    const struct fru_encoding *enc;
+    const uint8_t *src = tmpl->image;
+    const char *values[0xff];
+    int sizes[0xff];
+    int start[NUM_FRU_AREAS], moved[NUM_FRU_AREAS];
+    int in, out, length, size, i, n, s;
+    uint8_t sum;
+
+    /* the size of every slot value first, and with them of the areas */
+    length = hdr->image_length;
+    for (i = 0, s = 0; i < NUM_FRU_AREAS; i++) {
+        start[i] = src[fru_areas[i].header_offset] * 8;
+        if (!hdr->end_offset[i]) {
+            continue;
+        }
+        /* fields, end marker, checksum and reserve */
+        size = hdr->end_offset[i] + 2 - start[i] + hdr->reserve[i];
+        for (; s < hdr->num_slots && tmpl->slots[s].area == i; s++) {
+            slot = &tmpl->slots[s];
+            values[s] = NULL;
+            for (n = 0; n < ctx->num_ovr && !values[s]; n++) {
+                if (!strcmp(ctx->ovr_keys[n], slot->key)) {
+                    values[s] = ctx->ovr_vals[n];
+                }
+            }
+
+            enc = &fru_encodings[slot->encoding];
+            if (!values[s]) {
+                sizes[s] = slot->size;
+            } else if ((int) strlen(values[s]) > slot->capacity) {
+                return fru_fail(ctx, "%s is longer than its %d character "
+                                "slot", slot->key, slot->capacity);
+            } else if (!*values[s]) {
+                /* as layout_info_area() leaves out an empty value */
+                sizes[s] = slot->custom ? 0 : 1;
+            } else if ((sizes[s] = enc->pack(values[s], NULL)) < 0) {
+                return fru_fail(ctx, "%s can't be encoded as %s", slot->key,
+                                enc->name);
+            }
+            size += sizes[s] - slot->size;
+        }
+        size = get_aligned_size(size, 8);
+        length += size - src[start[i] + 1] * 8;
+    }
+    /* can only happen to a template that was tampered with */
+    if (length > (int) hdr->max_length) {
+        return fru_fail(ctx, "FRU data overflows the template");
+    }
+
+    in = out = 0;
+    for (i = 0, s = 0; i < NUM_FRU_AREAS; i++) {
+        moved[i] = out - in;
+        if (!hdr->end_offset[i]) {
+            continue;
+        }
+
+        memcpy(dst + out, src + in, start[i] - in);
+        out += start[i] - in;
+        in = start[i];
+        sum = hdr->partial_sum[i];
+
+        for (; s < hdr->num_slots && tmpl->slots[s].area == i; s++) {
+            slot = &tmpl->slots[s];
+            memcpy(dst + out, src + in, slot->offset - in);
+            out += slot->offset - in;
+            in = slot->offset + slot->size;
+
+            if (!values[s]) {
+                memcpy(dst + out, src + slot->offset, slot->size);
+            } else if (!*values[s]) {
+                dst[out] = 0;
+            } else {
+                fru_encodings[slot->encoding].pack(values[s], dst + out);
+            }
+            sum += fru_sum(dst + out, sizes[s]);
+            out += sizes[s];
+        }
+
+        /* the end marker, then padding and checksum as encode_info_area()
+         * writes them
+         */
+        n = hdr->end_offset[i] + 1 - in;
+        size = get_aligned_size(out - start[i] - moved[i] + n + 1 +
+                                hdr->reserve[i], 8);
+        memcpy(dst + out, src + in, n);
+        out += n;
+        in = start[i] + src[start[i] + 1] * 8;
+        memset(dst + out, 0, start[i] + moved[i] + size - 1 - out);
+        out = start[i] + moved[i] + size;
+        dst[start[i] + moved[i] + 1] = size / 8;
+        dst[out - 1] = -(sum + size / 8);
+    }
+
+    memcpy(dst + out, src + in, hdr->image_length - in);
+
+    /* the areas, and the MultiRecord area after them, moved by whole
+     * multiples of 8 bytes
+     */
+    for (i = 0; i < NUM_FRU_AREAS; i++) {
+        if (start[i]) {
+            dst[fru_areas[i].header_offset] += moved[i] / 8;
+        }
+    }
+    if (src[offsetof(struct fru_common_header, multirecord_info_offset)]) {
+        dst[offsetof(struct fru_common_header, multirecord_info_offset)] +=
+            (out - in) / 8;
+    }
+    dst[offsetof(struct fru_common_header, checksum)] =
+        get_zero_cksum(dst, sizeof(struct fru_common_header) - 1);
+
+    return length;
+}
+
+/* Fills the template like fru_template_fill() and writes the image to
+ * 'filename'. Returns the image length.
+ */
+int fru_template_write(struct fru_gen_ctx *ctx,
+                       const struct fru_template *tmpl, const char *filename)
+{
+    uint8_t *data;
+    int length;
+
+    data = (uint8_t *) fru_arena_alloc(ctx->arena, tmpl->hdr->max_length);
+    if ((length = fru_template_fill(ctx, tmpl, data)) < 0 ||
+        write_fru_image(ctx, filename, data, length)) {
+        return -1;
+    }
+
+    return length;
+}
+
+/* A type/length field of a mapped FRU image. The data points straight into
+ * the mapping, nothing is copied.
+ */
+struct fru_field {
+    uint8_t         type;
+    uint8_t         length;
+    const uint8_t   *data;
+};
+
+/* A read-only mapping of a FRU data file */
+struct fru_image {
+    const uint8_t   *data;
+    size_t          size;
+};
+
+static int map_fru_data(struct fru_gen_ctx *ctx, const char *filename,
+                        struct fru_image *img)
+{
+    int fd;
+    struct stat st;
+    void *addr;
+
+    img->data = NULL;
+    img->size = 0;
+
+    if ((fd = open(filename, O_RDONLY)) == -1) {
+        return fru_fail(ctx, "%s: %s", filename, strerror(errno));
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return fru_fail(ctx, "%s: %s", filename, strerror(errno));
+    }
+
+    if (st.st_size < sizeof(struct fru_common_header)) {
+        close(fd);
+        return fru_fail(ctx, "%s is too small to be a FRU data file",
+                        filename);
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return fru_fail(ctx, "%s: %s", filename, strerror(errno));
+    }
+
+    img->data = (const uint8_t *) addr;
+    img->size = st.st_size;
+
+    return 0;
+}
+
+static void unmap_fru_data(struct fru_image *img)
+{
+    if (img->data) {
+        munmap((void *) img->data, img->size);
+    }
+    img->data = NULL;
+    img->size = 0;
+}
+
+/* Returns 0 if the bytes sum up to zero (modulo 256) */
+static int check_zero_cksum(const uint8_t *data, int num_bytes)
+{
+    return fru_sum(data, num_bytes);
+}
+
+/* Validates the area at 'offset' (in multiples of 8) and returns a pointer
+ * to it. Only usable for areas that carry an area length, i.e. CIA/BIA/PIA.
+ */
+static const uint8_t *get_fru_area(const struct fru_image *img, uint8_t offset,
+                                   int *area_size)
+{
+    const uint8_t *area;
+    int start, size;
+
+    start = offset * 8;
+    if (start + 2 > img->size) {
+        return NULL;
+    }
+
+    area = img->data + start;
+    size = area[1] * 8;
+
+    if (area[0] != 0x01 || !size || start + size > img->size) {
+        return NULL;
+    }
+
+    if (check_zero_cksum(area, size)) {
+        return NULL;
+    }
+
+    *area_size = size;
+    return area;
+}
+
+/* Decodes the type/length field at *cursor and advances the cursor past it.
+ * Returns 1 if a field was decoded, 0 at the end marker and -1 if the field
+ * runs past 'end'.
+ */
+static int next_fru_field(const uint8_t **cursor, const uint8_t *end,
+                          struct fru_field *field)
+{
+    const uint8_t *p = *cursor;
+
+    if (p >= end) {
+        return -1;
+    }
+
+    if (*p == 0xc1) {
+        *cursor = p + 1;
+        return 0;
+    }
+
+    field->type = *p & 0xc0;
+    field->length = *p & 0x3f;
+    field->data = p + 1;
+
+    if (field->data + field->length > end) {
+        return -1;
+    }
+
+    *cursor = field->data + field->length;
+    return 1;
+}
+
+/* Unpacks 'len' bytes of 6-bit packed ASCII into 'str', which must hold
+ * (len * 8) / 6 + 1 bytes. Returns the number of characters unpacked.
+ */
+static int unpack_ascii6(const uint8_t *data, int len, char *str)
+{
+    int nchars;
+
+    nchars = (len * 8) / 6;
+    fru_unpack6(data, nchars, str);
+
+    /* Only a multiple of 3 bytes can hold one character less than it has
+     * room for, the zero bits left over then unpack as a space. That one
+     * is dropped, spaces the value itself ends with are kept.
+     */
+    if (len % 3 == 0 && nchars && str[nchars - 1] == ' ') {
+        nchars--;
+    }
+    str[nchars] = '\0';
+
+    return nchars;
+}
+
+static int unpack_bcdplus(const uint8_t *data, int len, char *str)
+{
+    int i, nchars;
+
+    nchars = len * 2;
+    for (i = 0; i < len; i++) {
+        /* 0xd-0xf are reserved, they unpack as '?' */
+        str[2 * i] = (data[i] >> 4) < 0xd ? bcdplus_chars[data[i] >> 4] : '?';
+        str[2 * i + 1] = (data[i] & 0xf) < 0xd ?
+                         bcdplus_chars[data[i] & 0xf] : '?';
+    }
+
+    /* an odd number of characters is padded with a space */
+    while (nchars && str[nchars - 1] == ' ') {
+        nchars--;
+    }
+    str[nchars] = '\0';
+
+    return nchars;
+}
+
+static void print_fru_field(FILE *out, const char *name,
+                            const struct fru_field *field)
+{
+    /* BCD plus unpacks to the most characters, 2 per byte */
+    char str[63 * 2 + 1];
+    int i;
+
+    fprintf(out, "%s = ", name);
+
+    switch (field->type) {
+        case TYPE_CODE_ASCII6:
+            unpack_ascii6(field->data, field->length, str);
+            fprintf(out, "%s", str);
+            break;
+        case TYPE_CODE_UNILATIN:
+            fprintf(out, "%.*s", field->length, field->data);
+            break;
+        case TYPE_CODE_BCDPLUS:
+            unpack_bcdplus(field->data, field->length, str);
+            fprintf(out, "%s", str);
+            break;
+        default:
+            for (i = 0; i < field->length; i++) {
+                fprintf(out, "%02x", field->data[i]);
+            }
+            break;
+    }
+
+    fprintf(out, "\n");
+}
+
+/* The IUA has no length of its own, it extends up to the next area */
+static int get_iua_size(const struct fru_image *img,
+                        const struct fru_common_header *fch)
+{
+    const uint8_t *offsets = &fch->internal_use_offset;
+    int i, start, end;
+
+    start = fch->internal_use_offset * 8;
+    end = img->size;
+
+    for (i = 1; i < 5; i++) {
+        if (offsets[i] && offsets[i] * 8 > start && offsets[i] * 8 < end) {
+            end = offsets[i] * 8;
+        }
+    }
+
+    return end - start;
+}
+
+/* Prints an info area as the config section that generates it. Custom
+ * fields follow the predefined ones and are shown as custom_N.
+ */
+static int print_info_area(struct fru_gen_ctx *ctx, FILE *out,
+                           const struct fru_image *img,
+                           const struct fru_area_desc *area, uint8_t offset)
+{
+    const struct fru_field_desc *desc;
+    const uint8_t *data, *p, *end;
+    struct fru_field field;
+    const char *key;
+    char custom[32];
+    int size, result, i;
+
+    data = get_fru_area(img, offset, &size);
+    if (!data) {
+        return fru_fail(ctx, "Invalid %s Info Area", area->name);
+    }
+
+    /* skip format version and area length, stop at the checksum */
+    p = data + 2;
+    end = data + size - 1;
+    result = 1;
+
+    fprintf(out, "[%s]\n", area->section);
+
+    for (i = 0; i < area->num_fields && result > 0; i++) {
+        desc = &area->fields[i];
+        key = fru_key_names[desc->key];
+
+        switch (desc->kind) {
+            case FIELD_CHASSIS_TYPE:
+            case FIELD_LANGUAGE_CODE:
+                fprintf(out, "%s = %d\n", key, *p++);
+                break;
+            case FIELD_MFG_DATETIME:
+                fprintf(out, "%s = %u\n", key,
+                        p[0] | (p[1] << 8) | (p[2] << 16));
+                p += 3;
+                break;
+            case FIELD_STRING:
+            case FIELD_FILE_ID:
+                result = next_fru_field(&p, end, &field);
+                /* empty predefined fields are not shown */
+                if (result > 0 && field.length) {
+                    print_fru_field(out, key, &field);
+                }
+                break;
+        }
+    }
+
+    for (i = 1; result > 0; i++) {
+        result = next_fru_field(&p, end, &field);
+        if (result > 0) {
+            snprintf(custom, sizeof(custom), "custom_%d", i);
+            print_fru_field(out, custom, &field);
+        }
+    }
+
+    fprintf(out, "\n");
+
+    if (result < 0) {
+        return fru_fail(ctx, "Malformed %s Info Area", area->name);
+    }
+
+    return result;
+}
+
+/* Prints the records of the MultiRecord area as [mra.N] sections */
+static int print_multirecords(struct fru_gen_ctx *ctx, FILE *out,
+                              const struct fru_image *img, uint8_t offset)
+{
+    const struct multirecord_header *hdr;
+    const struct mr_type_desc *type;
+    const struct mr_field_desc *field;
+    const uint8_t *p, *data;
+    unsigned long value;
+    uint8_t type_id;
+    char name[8];
+    int n, i, data_len, text;
+
+    p = img->data + offset * 8;
+
+    for (n = 0; ; n++) {
+        hdr = (const struct multirecord_header *) p;
+        data = p + sizeof(*hdr);
+
+        if (data > img->data + img->size ||
+            check_zero_cksum(p, sizeof(*hdr)) ||
+            (hdr->format & ~MR_END_OF_LIST) != MR_FORMAT_VERSION ||
+            data + hdr->length > img->data + img->size ||
+            (uint8_t) (fru_sum(data, hdr->length) + hdr->record_checksum)) {
+            return fru_fail(ctx, "Malformed MultiRecord area at record %d",
+                            n);
+        }
+
+        snprintf(name, sizeof(name), "%d", hdr->type_id);
+        type = find_mr_type(name, &type_id);
+        if (hdr->length < type->length) {
+            type = &mr_generic_type;
+        }
+
+        fprintf(out, "[%s.%d]\n", MRA, n);
+        if (type->name && type->type_id == hdr->type_id) {
+            fprintf(out, "type = %s\n", type->name);
+        } else {
+            fprintf(out, "type = 0x%02x\n", hdr->type_id);
+        }
+
+        for (i = 0; i < type->num_fields; i++) {
+            field = &type->fields[i];
+            value = get_bits(data, field->offset * 8 + field->shift,
+                             field->bits);
+            if (value < (unsigned long) field->num_names &&
+                field->names[value]) {
+                fprintf(out, "%s = %s\n", field->key, field->names[value]);
+            } else if (field->is_signed &&
+                       value >> (field->bits - 1)) {
+                fprintf(out, "%s = %ld\n", field->key,
+                        (long) value - (1L << field->bits));
+            } else {
+                fprintf(out, "%s = %lu\n", field->key, value);
+            }
+        }
+
+        data += type->length;
+        data_len = hdr->length - type->length;
+
+        /* text is only shown as such if it reads back the same */
+        text = type->data == MR_DATA_TEXT && data_len &&
+               data[0] != ' ' && data[data_len - 1] != ' ';
+        for (i = 0; text && i < data_len; i++) {
+            text = isprint(data[i]) && !strchr(";#\"", data[i]);
+        }
+
+        if (text) {
+            fprintf(out, "data = %.*s\n", data_len, (const char *) data);
+        } else if (data_len) {
+            fprintf(out, "data_hex = ");
+            for (i = 0; i < data_len; i++) {
+                fprintf(out, "%02X", data[i]);
+            }
+            fprintf(out, "\n");
+        }
+        fprintf(out, "\n");
+
+        if (hdr->format & MR_END_OF_LIST) {
+            return 0;
+        }
+        p = data + data_len;
+    }
+}
+
+/* Prints the FRU data in 'img' as the config that generates it. Areas
+ * that can't be decoded are skipped, the last failure is reported.
+ */
+static int decode_fru_image(struct fru_gen_ctx *ctx, FILE *out,
+                            const struct fru_image *img, const char *name)
+{
+    const struct fru_common_header *fch;
+    int size, result, i;
+    uint8_t offset;
+
+    if (img->size < sizeof(*fch)) {
+        return fru_fail(ctx, "%s is too small to be a FRU data file", name);
+    }
+
+    result = 0;
+    fch = (const struct fru_common_header *) img->data;
+
+    if (fch->format_version != 0x01 ||
+        check_zero_cksum(img->data, sizeof(*fch))) {
+        return fru_fail(ctx, "Invalid FRU common header in %s", name);
+    }
+
+    if (fch->internal_use_offset) {
+        size = get_iua_size(img, fch);
+        if (size <= 0) {
+            result = fru_fail(ctx, "Invalid internal use area offset");
+        } else {
+            fprintf(out, "[%s]\n; %d bytes of internal use data\n\n",
+                    IUA, size - (int) sizeof(struct internal_use_area));
+        }
+    }
+
+    for (i = 0; i < NUM_FRU_AREAS; i++) {
+        offset = img->data[fru_areas[i].header_offset];
+        if (offset && print_info_area(ctx, out, img, &fru_areas[i],
+                                      offset) < 0) {
+            result = -1;
+        }
+    }
+
+    if (fch->multirecord_info_offset &&
+        print_multirecords(ctx, out, img, fch->multirecord_info_offset) < 0) {
+        result = -1;
+    }
+
+    return result;
+}
+
+int fru_read_data(struct fru_gen_ctx *ctx, const char *filename, FILE *out)
+{
+    struct fru_image img;
+    int result;
+
+    if (map_fru_data(ctx, filename, &img)) {
+        return -1;
+    }
+
+    result = decode_fru_image(ctx, out, &img, filename);
+
+    unmap_fru_data(&img);
+
+    return result;
+}
+
+int fru_decode(struct fru_gen_ctx *ctx, const uint8_t *data, size_t size,
+               char *buf, size_t buf_size)
+{
+    struct fru_image img;
+    char *text;
+    size_t len;
+    FILE *out;
+    int result;
+
+    if (buf_size) {
+        buf[0] = '\0';
+    }
+    if (!(out = open_memstream(&text, &len))) {
+        return fru_fail(ctx, "Out of memory!");
+    }
+
+    img.data = data;
+    img.size = size;
+    result = decode_fru_image(ctx, out, &img, "FRU data");
+
+    /* on an error, the areas decoded so far are still worth having */
+    fclose(out);
+    if (buf_size) {
+        snprintf(buf, buf_size, "%s", text);
+    }
+    free(text);
+
+    return result ? result : (int) len;
+}
+
+/* Locates field 'key', a predefined key or custom_N, in the info area
+ * 'data' of 'size' bytes. Returns its offset in the area, -1 if the area
+ * has no such field or is malformed. '*used' is set to the number of bytes
+ * the fields take, end marker included.
+ */
+static int find_area_field(const struct fru_area_desc *area,
+                           const uint8_t *data, int size, const char *key,
+                           enum fru_field_kind *kind, int *used)
+{
+    const uint8_t *p, *end, *start;
+    struct fru_field field;
+    enum fru_key k;
+    int i, custom, pos, result;
+
+    k = lookup_key(key);
+    custom = 0;
+    if (k == KEY_CUSTOM &&
+        (sscanf(key, "custom_%d", &custom) != 1 || custom < 1)) {
+        return -1;
+    }
+
+    /* skip format version and area length, stop at the checksum */
+    p = data + 2;
+    end = data + size - 1;
+    pos = -1;
+    result = 1;
+
+    for (i = 0; i < area->num_fields && result > 0; i++) {
+        start = p;
+        switch (area->fields[i].kind) {
+            case FIELD_CHASSIS_TYPE:
+            case FIELD_LANGUAGE_CODE:
+                p += 1;
+                break;
+            case FIELD_MFG_DATETIME:
+                p += 3;
+                break;
+            case FIELD_STRING:
+            case FIELD_FILE_ID:
+                result = next_fru_field(&p, end, &field);
+                break;
+        }
+        if (p > end) {
+            result = -1;
+        } else if (result > 0 && area->fields[i].key == k) {
+            pos = start - data;
+            *kind = area->fields[i].kind;
+        }
+    }
+
+    for (i = 1; result > 0; i++) {
+        start = p;
+        result = next_fru_field(&p, end, &field);
+        if (result > 0 && i == custom) {
+            pos = start - data;
+            *kind = FIELD_STRING;
+        }
+    }
+
+    if (result < 0) {
+        return -1;
+    }
+
+    *used = p - data;
+    return pos;
+}
+
+/* The encoding a field is stored with, NULL for an empty field */
+static const struct fru_encoding *get_field_encoding(const uint8_t *field)
+{
+    if (!(*field & 0x3f)) {
+        return NULL;
+    }
+
+    switch (*field & 0xc0) {
+        case TYPE_CODE_BCDPLUS:
+            return find_encoding("bcdplus");
+        case TYPE_CODE_ASCII6:
+            return find_encoding("ascii6");
+        case TYPE_CODE_UNILATIN:
+            return find_encoding("ascii8");
+        default:
+            return find_encoding("binary");
+    }
+}
+
+/* Rewrites the field of "section:key=value" in the info area 'area' of
+ * 'size' bytes. A field that changes size moves the fields after it within
+ * the padding of the area, so nothing outside the area changes. Only the
+ * bytes that change are summed to update the checksum. Returns the number
+ * of bytes missing if the padding is too small, leaving the area as is.
+ */
+static int patch_area_field(struct fru_gen_ctx *ctx,
+                            const struct fru_area_desc *desc, uint8_t *area,
+                            int size, const char *key, const char *value,
+                            int keep_encoding)
+{
+    const struct fru_encoding *enc;
+    enum fru_field_kind kind;
+    uint8_t old[64], *field;
+    int pos, used, old_len, new_len, delta, i;
+    long num;
+    char *end;
+
+    pos = find_area_field(desc, area, size, key, &kind, &used);
+    if (pos < 0) {
+        return fru_fail(ctx, "%s:%s not found in the %s Info Area",
+                        desc->section, key, desc->name);
+    }
+    field = area + pos;
+
+    if (kind != FIELD_STRING && kind != FIELD_FILE_ID) {
+        old_len = kind == FIELD_MFG_DATETIME ? 3 : 1;
+        errno = 0;
+        num = strtol(value, &end, 0);
+        if (end == value || *end || errno || num < 0 ||
+            num >= 1L << (old_len * 8)) {
+            return fru_fail(ctx, "Invalid value %s for %s:%s", value,
+                            desc->section, key);
+        }
+        memcpy(old, field, old_len);
+        for (i = 0; i < old_len; i++) {
+            field[i] = num >> (i * 8);
+        }
+        area[size - 1] = update_zero_cksum(area[size - 1], old, old_len,
+                                           field, old_len);
+        return 0;
+    }
+
+    enc = keep_encoding ? get_field_encoding(field) : NULL;
+    if (!enc) {
+        enc = ctx->encoding;
+    }
+
+    new_len = enc->pack(value, NULL);
+    if (new_len == -1) {
+        return fru_fail(ctx, "%s:%s is too long", desc->section, key);
+    } else if (new_len < 0) {
+        return fru_fail(ctx, "%s:%s can't be encoded as %s", desc->section,
+                        key, enc->name);
+    }
+
+    old_len = 1 + (*field & 0x3f);
+    delta = new_len - old_len;
+    if (delta > size - 1 - used) {
+        return delta - (size - 1 - used);
+    }
+
+    /* padding taken up by a longer field is replaced too */
+    if (delta > 0) {
+        area[size - 1] = update_zero_cksum(area[size - 1], area + used, delta,
+                                           NULL, 0);
+    }
+
+    memcpy(old, field, old_len);
+    memmove(field + new_len, field + old_len, used - pos - old_len);
+    if (delta < 0) {
+        memset(area + used + delta, 0, -delta);
+    }
+    enc->pack(value, field);
+
+    area[size - 1] = update_zero_cksum(area[size - 1], old, old_len, field,
+                                       new_len);
+
+    return 0;
+}
+
+/* Grows the info area at 'area_offset' (in multiples of 8) of the mapped
+ * FRU data file by 'blocks' blocks of 8 bytes. The areas after it move
+ * down, the file grows and the common header follows. On failure the
+ * image is left as is, unless it couldn't be mapped again.
+ */
+static int grow_fru_area(int fd, struct fru_image *img, uint8_t area_offset,
+                         int blocks)
+{
+    struct fru_common_header *fch;
+    uint8_t *data, *area, *offsets, old_blocks;
+    size_t size;
+    int end, i;
+
+    data = (uint8_t *) img->data;
+    fch = (struct fru_common_header *) data;
+    offsets = &fch->internal_use_offset;
+
+    if (data[area_offset * 8 + 1] + blocks > 0xff) {
+        return -1;
+    }
+    for (i = 0; i < 5; i++) {
+        if (offsets[i] > area_offset && offsets[i] + blocks > 0xff) {
+            return -1;
+        }
+    }
+
+    size = img->size + blocks * 8;
+    if (ftruncate(fd, size) < 0) {
+        return -1;
+    }
+
+    munmap(data, img->size);
+    data = (uint8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            fd, 0);
+    if (data == MAP_FAILED) {
+        img->data = NULL;
+        img->size = 0;
+        return -1;
+    }
+
+    /* the new padding goes in front of the checksum, which stays last */
+    area = data + area_offset * 8;
+    end = area_offset * 8 + area[1] * 8;
+    memmove(data + end - 1 + blocks * 8, data + end - 1,
+            img->size - (end - 1));
+    memset(data + end - 1, 0, blocks * 8);
+
+    old_blocks = area[1];
+    area[1] += blocks;
+    area[area[1] * 8 - 1] = update_zero_cksum(area[area[1] * 8 - 1],
+                                              &old_blocks, 1, &area[1], 1);
+
+    fch = (struct fru_common_header *) data;
+    offsets = &fch->internal_use_offset;
+    for (i = 0; i < 5; i++) {
+        if (offsets[i] > area_offset) {
+            offsets[i] += blocks;
+        }
+    }
+    fch->checksum = get_zero_cksum(data, sizeof(*fch) - 1);
+
+    img->data = data;
+    img->size = size;
+
+    return 0;
+}
+
+/* Applies "section:key=value" patches to the info areas of the FRU data
+ * file 'filename', mapped read-write so that only the changed pages get
+ * written back. An area whose padding can't take a longer value grows,
+ * moving the areas after it. Unless 'keep_encoding' is 0, text fields keep
+ * the encoding they are stored with. Patches before a failing one stay
+ * applied, each leaves a valid image.
+ */
+int fru_patch_data(struct fru_gen_ctx *ctx, const char *filename,
+                   char **patches, int num_patches, int keep_encoding)
+{
+    const struct fru_area_desc *desc;
+    struct fru_image img;
+    uint8_t *area, offset;
+    char *patch, *key, *value;
+    struct stat st;
+    int fd, size, result, blocks, i, j;
+    void *addr;
+
+    fd = open(filename, O_RDWR);
+    if (fd < 0) {
+        return fru_fail(ctx, "%s: %s", filename, strerror(errno));
+    }
+
+    if (fstat(fd, &st) < 0 ||
+        st.st_size < (off_t) sizeof(struct fru_common_header)) {
+        close(fd);
+        return fru_fail(ctx, "%s is not a FRU data file", filename);
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        close(fd);
+        return fru_fail(ctx, "%s: %s", filename, strerror(errno));
+    }
+
+    img.data = (const uint8_t *) addr;
+    img.size = st.st_size;
+    result = 0;
+
+    if (img.data[0] != 0x01 ||
+        check_zero_cksum(img.data, sizeof(struct fru_common_header))) {
+        result = fru_fail(ctx, "Invalid FRU common header in %s", filename);
+    }
+
+    for (i = 0; i < num_patches && !result; i++) {
+        patch = strcpy((char *) fru_arena_alloc(ctx->arena,
+                                                strlen(patches[i]) + 1),
+                       patches[i]);
+        key = strchr(patch, ':');
+        value = key ? strchr(key, '=') : NULL;
+        if (!value) {
+            result = fru_fail(ctx, "Invalid patch %s, expected "
+                              "section:key=value", patches[i]);
+            break;
+        }
+        *key++ = '\0';
+        *value++ = '\0';
+
+        desc = NULL;
+        for (j = 0; j < NUM_FRU_AREAS; j++) {
+            if (!strcmp(fru_areas[j].section, patch)) {
+                desc = &fru_areas[j];
+            }
+        }
+        if (!desc) {
+            result = fru_fail(ctx, "Only %s, %s and %s fields can be patched",
+                              fru_areas[0].section, fru_areas[1].section,
+                              fru_areas[2].section);
+            break;
+        }
+
+        offset = img.data[desc->header_offset];
+        area = offset ? (uint8_t *) get_fru_area(&img, offset, &size) : NULL;
+        if (!area) {
+            result = fru_fail(ctx, "No valid %s Info Area in %s", desc->name,
+                              filename);
+            break;
+        }
+
+        result = patch_area_field(ctx, desc, area, size, key, value,
+                                  keep_encoding);
+        if (result <= 0) {
+            continue;
+        }
+
+        blocks = (result + 7) / 8;
+        if (grow_fru_area(fd, &img, offset, blocks)) {
+            result = fru_fail(ctx, "%s:%s doesn't fit, the %s Info Area "
+                              "can't grow by %d bytes", desc->section, key,
+                              desc->name, blocks * 8);
+            break;
+        }
+        fru_notify(ctx, 0, "Grew the %s Info Area by %d bytes", desc->name,
+                   blocks * 8);
+
+        area = (uint8_t *) img.data + offset * 8;
+        result = patch_area_field(ctx, desc, area, area[1] * 8, key, value,
+                                  keep_encoding);
+    }
+
+    if (img.data) {
+        if (msync((void *) img.data, img.size, MS_SYNC) < 0 && !result) {
+            result = fru_fail(ctx, "%s: %s", filename, strerror(errno));
+        }
+        munmap((void *) img.data, img.size);
+    }
+    close(fd);
+
+    return result;
+}
+
+
+#ifdef TESTFRU
+/* Generates board areas whose serial number is packed as 6-bit ASCII and
+ * checks that it decodes back unchanged, for packed lengths of every
+ * remainder modulo 3 and for values that end in spaces. Built and run by
+ * "make check".
+ */
+int main(void)
+{
+    static const struct {
+        const char  *value;
+        const char  *decoded;
+    } tests[] = {
+        { "A",          "A" },          /* 1 byte */
+        { "AB",         "AB" },         /* 2 bytes */
+        { "ABC",        "ABC" },        /* 3 bytes, one padding sextet */
+        { "ABCD",       "ABCD" },       /* 3 bytes, no padding */
+        { "ABCDE",      "ABCDE" },      /* 4 bytes */
+        { "ABCDEFG",    "ABCDEFG" },    /* 6 bytes, one padding sextet */
+        { "ABCDEFGH",   "ABCDEFGH" },   /* 6 bytes, no padding */
+        { "A ",         "A " },         /* 2 bytes */
+        { "AB ",        "AB " },        /* 3 bytes, one padding sextet */
+        { "ABCDE ",     "ABCDE " },     /* 5 bytes */
+        { "ABCDE  ",    "ABCDE  " },    /* 6 bytes, one padding sextet */
+        /* a space in the last sextet reads the same as the padding */
+        { "ABC ",       "ABC" },
+    };
+    struct fru_field_value fields[] = {
+        { "bia", "manufacturer",  "M" },
+        { "bia", "product_name",  "P" },
+        { "bia", "part_number",   "1" },
+        { "bia", "serial_number", NULL },
+    };
+    struct fru_gen_ctx ctx;
+    char text[1024], want[64];
+    uint8_t *data;
+    int i, len, failed;
+
+    fru_ctx_init(&ctx, NULL);
+    failed = 0;
+
+    for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); i++) {
+        fields[3].value = tests[i].value;
+        len = fru_encode_fields(&ctx, fields, 4, &data);
+        if (len < 0 || fru_decode(&ctx, data, len, text, sizeof(text)) < 0) {
+            printf("\"%s\": %s\n", tests[i].value, fru_error(&ctx));
+            failed++;
+            continue;
+        }
+
+        snprintf(want, sizeof(want), "\nserial_number = %s\n",
+                 tests[i].decoded);
+        if (!strstr(text, want)) {
+            printf("\"%s\": does not decode as \"%s\"\n", tests[i].value,
+                   tests[i].decoded);
+            failed++;
+        }
+        fru_arena_reset(ctx.arena);
+    }
+
+    fru_ctx_release(&ctx);
+    printf("%d 6-bit ASCII fields, %d failures\n", i, failed);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
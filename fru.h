@@ -0,0 +1,222 @@
+#ifndef FRU_H
+#define FRU_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "iniparser.h"
+
+/*
+ * libfru: IPMI FRU data generation from a config dictionary, and decoding
+ * back into the same config format.
+ *
+ * Everything a call needs lives in a struct fru_gen_ctx, so contexts can be
+ * used from separate threads at once as long as they don't share one. The
+ * functions returning int return -1 on failure and leave a message in
+ * fru_error(). Running out of memory still ends the process.
+ */
+
+/* Chassis, board and product info areas */
+#define NUM_FRU_AREAS   3
+
+#define FRU_ERROR_SIZE  256
+
+/* A bump allocator. Everything a FRU generation allocates comes from its
+ * arena and is released at once by fru_arena_reset(), which keeps the
+ * chunks around for the next generation.
+ */
+struct fru_arena_chunk;
+
+struct fru_arena {
+    struct fru_arena_chunk  *first;
+    struct fru_arena_chunk  *current;
+};
+
+/* How a string is stored in a type/length field */
+struct fru_encoding {
+    const char  *name;
+    int         (*pack)(const char *, uint8_t *);
+};
+
+struct fru_area_desc;
+struct fru_pack_cache;
+struct mr_type_desc;
+
+/* Where everything goes in a FRU image, worked out from the encoded sizes
+ * of its fields before any byte is written.
+ */
+struct fru_area_value {
+    const char                  *key;
+    const char                  *str;       /* NULL for an empty field */
+    const struct fru_encoding   *enc;
+    int                         size;       /* 0 once dropped */
+    /* set in the [encoding] section, never changed to fit -s */
+    int                         pinned;
+    int                         custom;
+};
+
+struct fru_area_layout {
+    const struct fru_area_desc  *desc;      /* NULL if the area is left out */
+    int                         offset;
+    /* bytes taken by the fields, end marker and checksum */
+    int                         used;
+    /* bytes kept free for patching, from the "reserve" key */
+    int                         reserve;
+    /* 'used' plus 'reserve', padded to a multiple of 8 */
+    int                         size;
+    /* the bytes following the area length: chassis type, language code... */
+    uint8_t                     fixed[4];
+    int                         num_fixed;
+    /* type/length fields in order */
+    struct fru_area_value       *values;
+    int                         num_values;
+};
+
+struct mr_record_layout {
+    const char                  *section;
+    const struct mr_type_desc   *type;
+    uint8_t                     type_id;
+    /* the data following the fields, as given by "data" or "data_hex" */
+    const char                  *data;
+    int                         data_hex;
+    int                         length;     /* of the record data */
+};
+
+struct fru_layout {
+    const char                  *iua_file;  /* NULL if there is no IUA */
+    int                         iua_offset;
+    int                         iua_size;
+    int                         iua_data_size;
+    struct fru_area_layout      areas[NUM_FRU_AREAS];
+    struct mr_record_layout     *records;
+    int                         num_records;
+    int                         mra_offset;
+    int                         mra_size;
+    int                         length;
+};
+
+/* State of one FRU generation. Nothing in it is shared, so concurrent
+ * generations from the same config each use their own context.
+ */
+struct fru_gen_ctx {
+    dictionary  *ini;
+    /* Encoding of the fields not listed in the [encoding] section */
+    const struct fru_encoding *encoding;
+    /* Backs every allocation made while generating FRU data */
+    struct fru_arena *arena;
+    /* Receives what a call reports along the way: defaults it took and
+     * what fitting the size budget changed, or with 'warning' set, config
+     * entries it ignored. NULL drops them. The library prints nothing.
+     */
+    void        (*notify)(void *arg, int warning, const char *msg);
+    void        *notify_arg;
+    /* Drops the informational messages, warnings still go to 'notify' */
+    int         quiet;
+    /* Size fru_encode() has to fit the FRU data in, 0 for no limit */
+    int         max_size;
+    /* Per-unit values that take precedence over the config */
+    char        **ovr_keys;
+    char        **ovr_vals;
+    int         num_ovr;
+    /* Packed fields by encoding and string, NULL to pack every time. See
+     * fru_cache_enable().
+     */
+    struct fru_pack_cache *cache;
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    /* Why the last call failed */
+    char        error[FRU_ERROR_SIZE];
+    /* What 'arena' points to, unless the caller sets its own */
+    struct fru_arena own_arena;
+};
+
+struct fru_template_header;
+struct fru_template_slot;
+
+/* A template compiled by fru_compile(), mapped read-only from its file, or
+ * compiled into memory by fru_template_compile()
+ */
+struct fru_template {
+    const struct fru_template_header    *hdr;
+    const struct fru_template_slot      *slots;
+    const uint8_t                       *image;
+    size_t                              map_size;   /* 0 when in memory */
+};
+
+/* A config value given directly, for fru_encode_fields() */
+struct fru_field_value {
+    const char  *section;
+    const char  *key;
+    const char  *value;
+};
+
+/* Sets up 'ctx' to generate from 'ini', which may be NULL when only
+ * fru_encode_fields() and the decoding functions are used.
+ */
+void fru_ctx_init(struct fru_gen_ctx *ctx, dictionary *ini);
+void fru_ctx_release(struct fru_gen_ctx *ctx);
+const char *fru_error(const struct fru_gen_ctx *ctx);
+/* Selects the encoding of the fields not listed in the [encoding] section */
+int fru_set_encoding(struct fru_gen_ctx *ctx, const char *name);
+/* Gives the context a bounded cache of packed fields, which pays off when
+ * it generates many units sharing values. A copied context must get its
+ * own: set 'cache' to NULL and enable it again.
+ */
+int fru_cache_enable(struct fru_gen_ctx *ctx);
+
+/* Generate FRU data into the context's arena, where it stays valid until
+ * the arena is reset. Return its length.
+ */
+int fru_encode(struct fru_gen_ctx *ctx, uint8_t **data);
+int fru_encode_fields(struct fru_gen_ctx *ctx,
+                      const struct fru_field_value *fields, int num_fields,
+                      uint8_t **data);
+/* Decodes FRU data into 'buf' as config text, NUL terminated. Returns the
+ * length of the whole text, which was cut short if it's 'buf_size' or more.
+ * The text is built in a heap allocated stream and then copied to 'buf'.
+ * On an error -1 is returned and 'buf' still holds the text decoded up to
+ * it.
+ */
+int fru_decode(struct fru_gen_ctx *ctx, const uint8_t *data, size_t size,
+               char *buf, size_t buf_size);
+
+/* The steps behind fru_encode(), for output straight to a file or device */
+int fru_layout_data(struct fru_gen_ctx *ctx, struct fru_layout *layout);
+int fru_fit_layout(struct fru_gen_ctx *ctx, struct fru_layout *layout,
+                   int max_size);
+int fru_write_data(struct fru_gen_ctx *ctx, const struct fru_layout *layout,
+                   const char *filename);
+int fru_program_device(struct fru_gen_ctx *ctx,
+                       const struct fru_layout *layout, const char *device,
+                       int page_size);
+
+/* Templates: the FRU image pre-encoded with slots for the fields listed in
+ * the [template] section and the "${name}" placeholders. Filling a template
+ * takes the slot values from the context's overrides, keyed by slot name,
+ * and needs no config. fru_template_length() is the most a fill can take,
+ * fru_template_fill() and fru_template_write() return the actual length.
+ */
+int fru_has_placeholders(struct fru_gen_ctx *ctx);
+int fru_compile(struct fru_gen_ctx *ctx, const char *filename);
+int fru_template_compile(struct fru_gen_ctx *ctx, struct fru_template *tmpl);
+int fru_template_open(struct fru_gen_ctx *ctx, const char *filename,
+                      struct fru_template *tmpl);
+void fru_template_close(struct fru_template *tmpl);
+int fru_template_length(const struct fru_template *tmpl);
+int fru_template_find_slot(const struct fru_template *tmpl, const char *key);
+int fru_template_fill(struct fru_gen_ctx *ctx,
+                      const struct fru_template *tmpl, uint8_t *dst);
+int fru_template_write(struct fru_gen_ctx *ctx,
+                       const struct fru_template *tmpl, const char *filename);
+
+int fru_read_data(struct fru_gen_ctx *ctx, const char *filename, FILE *out);
+int fru_patch_data(struct fru_gen_ctx *ctx, const char *filename,
+                   char **patches, int num_patches, int keep_encoding);
+
+void *fru_arena_alloc(struct fru_arena *arena, size_t size);
+void *fru_arena_zalloc(struct fru_arena *arena, size_t size);
+void fru_arena_reset(struct fru_arena *arena);
+void fru_arena_free(struct fru_arena *arena);
+
+#endif
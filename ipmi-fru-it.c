@@ -1,14 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
-#include <fcntl.h>
 #include <ctype.h>
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-#include "iniparser.h"
-#include "fru-defs.h"
+#include "fru.h"
 
 #define TOOL_VERSION "0.2"
 
@@ -18,877 +21,795 @@ char usage[] =
 "\t-h\t\tThis help text\n"
 "\t-v\t\tPrint version and exit\n"
 "\t-r\t\tRead FRU data from file specified by -i\n"
-"\t-i FILE\t\tFRU data file (use with -r)\n"
+"\t-i FILE\t\tFRU data file (use with -r or -p)\n"
+"\t-p S:K=VALUE\tPatch field K of section S of the -i file in place,\n"
+"\t\t\tcan be repeated. With -c or -t, -p NAME=VALUE fills\n"
+"\t\t\ta slot or ${NAME} placeholder instead\n"
 "\t-w\t\tWrite FRU data to file specified in -o\n"
-"\t-c FILE\t\tFRU Config file\n"
+"\t-c FILE\t\tFRU Config file, can be repeated with --serve\n"
 "\t-s SIZE\t\tMaximum file size (in bytes) allowed for the FRU data file\n"
-"\t-o FILE\t\tOutput FRU data filename (use with -w)\n\n";
-
-/* Std IPMI FRU Section headers */
-const char *IUA = "iua";
-const char *CIA = "cia";
-const char *BIA = "bia";
-const char *PIA = "pia";
-
-/* IUA section must-have keys */
-const char* BINFILE = "bin_file";
-
-/* predefined keys */
-const char* CHASSIS_TYPE    = "chassis_type";
-const char* PART_NUMBER     = "part_number";
-const char* SERIAL_NUMBER   = "serial_number";
-const char* LANGUAGE_CODE   = "language_code";
-const char* MFG_DATETIME    = "mfg_datetime";
-const char* MANUFACTURER    = "manufacturer";
-const char* PRODUCT_NAME    = "product_name";
-const char* VERSION         = "version";
-const char* ASSET_TAG       = "asset_tag";
-const char* FRU_FILE_ID     = "fru_file_id";
-
-int (*packer)(const char *, char **);
-
-inline uint8_t get_6bit_ascii(char c)
-{
-    return (c - 0x20) & 0x3f;
-}
-
-inline uint8_t get_aligned_size(uint8_t size, uint8_t align)
-{
-    return (size + align - 1) & ~(align - 1);
-}
-
-inline uint8_t get_fru_tl_type(struct fru_type_length *ftl)
+"\t-o FILE\t\tOutput FRU data filename (use with -w)\n"
+"\t-d DEVICE\tProgram the FRU data into an EEPROM device (or file),\n"
+"\t\t\twriting only the pages that change (use with -w)\n"
+"\t-g SIZE\t\tPage size of the -d device in bytes (default 8)\n"
+"\t-e ENC\t\tEncoding of text fields: ascii6 (default), ascii8, latin1,\n"
+"\t\t\tbcdplus, binary or auto (smallest per field)\n"
+"\t-a\t\tSame as -e ascii8\n"
+"\t-b FILE\t\tCSV manifest of per-unit values, generates one FRU data\n"
+"\t\t\tfile per row (use with -c)\n"
+"\t-j N\t\tNumber of threads generating manifest rows (use with -b)\n"
+"\t-C FILE\t\tCompile the -c config into a template file\n"
+"\t-t FILE\t\tGenerate from a compiled template instead of -c\n"
+"\t\t\t(use with -o or -b)\n"
+"\t-S\t\tPrint packing cache statistics when done\n"
+"\t--serve SOCK\tServe FRU data from the -c configs over a Unix socket\n\n";
+
+/* Long options without a short equivalent */
+enum {
+    OPT_SERVE = 256,
+};
+
+struct option long_options[] = {
+    { "serve",  required_argument,  NULL,   OPT_SERVE },
+    { NULL,     0,                  NULL,   0 }
+};
+
+static void str_tolower(char *str)
 {
-    return ftl->type_length & 0xc0;
-}
-
-inline uint8_t get_fru_tl_length(struct fru_type_length *ftl)
-{
-    return ftl->type_length & 0x3f;
-}
-
-uint8_t get_zero_cksum(uint8_t *data, int num_bytes)
-{
-    int sum = 0;
-    while (num_bytes--) {
-        sum += *(data++);
+    for (; *str; str++) {
+        *str = tolower(*str);
     }
-    return -(sum % 256);
 }
 
-char *get_key(const char *section, const char* key)
+/* Splits a CSV line in place. Fields may be double-quoted, in which case
+ * they can contain commas and "" stands for a literal quote. Returns the
+ * number of fields found, growing *fields as needed.
+ */
+int split_csv_line(char *line, char ***fields, int *max_fields)
 {
-    int len;
-    char *concat;
+    char *p, *start, *end, sep;
+    int num_fields;
 
-    /* 1 byte for : and another for nul */
-    len = strlen(section) + strlen(key) + 2; 
-    concat = (char *) malloc(len);
-    strcpy(concat, section);
-    strcat(concat, ":");
-    strcat(concat, key);
+    p = line;
+    num_fields = 0;
 
-    return concat;
-}
-
-int pack_ascii8(const char *str, char **raw_data)
-{
-    char *data;
-    struct fru_type_length *ftl;
-    uint8_t tl = TYPE_CODE_UNILATIN;
-    int len, size;
-
-    len = strlen(str);
-    size = 0;
-
-    uint8_t numbytes = len & 0x3f;
-
-    /* Set length. It can be a max of 64 bytes */
-    tl |= numbytes;
-
-    size = numbytes + sizeof(struct fru_type_length);
+    do {
+        if (num_fields == *max_fields) {
+            *max_fields = *max_fields ? *max_fields * 2 : 16;
+            *fields = (char **) realloc(*fields, *max_fields * sizeof(char *));
+        }
 
-    data = (char *) calloc(size, 1);
-    ftl = (struct fru_type_length *) data;
-    ftl->type_length = tl;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
 
-    memcpy(ftl->data, str, len);
+        if (*p == '"') {
+            start = end = ++p;
+            while (*p) {
+                if (*p == '"') {
+                    if (*(p + 1) != '"') {
+                        p++;
+                        break;
+                    }
+                    p++;
+                }
+                *(end++) = *(p++);
+            }
+            while (*p && *p != ',') {
+                p++;
+            }
+        } else {
+            start = p;
+            while (*p && *p != ',') {
+                p++;
+            }
+            end = p;
+            while (end > start && isspace(*(end - 1))) {
+                end--;
+            }
+        }
 
-    *raw_data = data;
-    return size;
-}
+        sep = *p;
+        *end = '\0';
+        (*fields)[num_fields++] = start;
+        p++;
+    } while (sep == ',');
 
-int pack_ascii6(const char *str, char **raw_data)
-{
-    char *data;
-    struct fru_type_length *ftl;
-    uint8_t tl = TYPE_CODE_ASCII6;
-    int len, size, i, j;
-
-    len = strlen(str);
-    size = 0;
-
-    /* 6-bit ASCII packed allocates 6 bits per char */
-    int rem = (len * 6) % 8;
-    int div = (len * 6) / 8;
-    uint8_t numbytes = (rem ? div + 1 : div) & 0x3f;
-    
-    /* Set length. It can be a max of 64 bytes */
-    tl |= numbytes;
-
-    size = numbytes + sizeof(struct fru_type_length);
-
-    data = (char *) calloc(size, 1);
-    ftl = (struct fru_type_length *) data;
-    ftl->type_length = tl;
-
-    j = 0;
-    for (i = 0; i+3 < len; i += 4) {
-        *(ftl->data + j) = get_6bit_ascii(str[i]) | (get_6bit_ascii(str[i+1]) << 6);
-        *(ftl->data + j + 1) = (get_6bit_ascii(str[i+1]) >> 2) | (get_6bit_ascii(str[i+2]) << 4);
-        *(ftl->data + j + 2) = (get_6bit_ascii(str[i+2]) >> 4) | (get_6bit_ascii(str[i+3]) << 2);
-        j += 3;
-    }
-
-    /* pack remaining (< 4) bytes */
-    switch ((len - i) % 4) {
-        case 3:
-            *(ftl->data + j) = get_6bit_ascii(str[i]) | (get_6bit_ascii(str[i+1]) << 6);
-            *(ftl->data + j + 1) = (get_6bit_ascii(str[i+1]) >> 2) | (get_6bit_ascii(str[i+2]) << 4);
-            *(ftl->data + j + 2) = get_6bit_ascii(str[i+2]) >> 4;
-            break;
-        case 2:
-            *(ftl->data + j) = get_6bit_ascii(str[i]) | (get_6bit_ascii(str[i+1]) << 6);
-            *(ftl->data + j + 1) = get_6bit_ascii(str[i+1]) >> 2;
-            break;
-        case 1:
-            *(ftl->data + j) = get_6bit_ascii(str[i]);
-        default:
-            break;
-    }
-
-    *raw_data = data;
-    return size;
+    return num_fields;
 }
 
-/* All gen_* functions, except gen_iua(), return size as multiples of 8 */
-int gen_iua(dictionary *ini, char **iua_data)
+/* One manifest row */
+struct batch_unit {
+    char    *line;      /* the row, split in place into values */
+    char    **values;
+    int     lineno;
+    char    *error;     /* why the unit failed, NULL on success */
+};
+
+struct batch_job {
+    struct fru_gen_ctx  *tmpl;
+    /* generate by filling this template instead of from the config */
+    const struct fru_template *compiled;
+    struct batch_unit   *units;
+    char                *header;
+    char                **columns;
+    int                 num_columns;
+    int                 output_col;
+    int                 max_size;
+    struct batch_worker *workers;
+    int                 num_workers;
+};
+
+/* Each worker owns the units [head, tail). Idle workers steal the upper
+ * half of another worker's range, so no unit is ever handed out twice.
+ */
+struct batch_worker {
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    int                 head;
+    int                 tail;
+    struct batch_job    *job;
+    /* of the worker's packing cache, added up once it's done */
+    unsigned long       cache_hits;
+    unsigned long       cache_misses;
+};
+
+/* Returns the index of the next unit for worker 'w' or -1 if all work is
+ * done. Only one lock is held at a time.
+ */
+int take_batch_unit(struct batch_worker *w)
 {
-    int fd, flags, size;
-    struct stat st;
-
-    char *binkey, *filename, *data;
-    struct internal_use_area *iua;
-
-    /* initialize some sane values */
-    fd = -1;
-    flags = size = 0;
-    data = NULL;
-    
-    /* We expect this section to have a single key - "binfile", with a value
-     * of the absolute path to the binary file to write to in the IUA
-     */
-    binkey = get_key(IUA, BINFILE);
-    
-    filename = iniparser_getstring(ini, binkey, NULL);
+    struct batch_job *job = w->job;
+    struct batch_worker *victim;
+    int unit, remaining, most, steal, start, end, i;
+
+    pthread_mutex_lock(&w->lock);
+    unit = w->head < w->tail ? w->head++ : -1;
+    pthread_mutex_unlock(&w->lock);
+
+    while (unit == -1) {
+        /* pick the worker with the most work left */
+        victim = NULL;
+        most = 0;
+        for (i = 0; i < job->num_workers; i++) {
+            pthread_mutex_lock(&job->workers[i].lock);
+            remaining = job->workers[i].tail - job->workers[i].head;
+            pthread_mutex_unlock(&job->workers[i].lock);
+            if (remaining > most) {
+                most = remaining;
+                victim = &job->workers[i];
+            }
+        }
+        if (!victim) {
+            return -1;
+        }
 
-    if (!filename) {
-        fprintf(stderr, "\n%s not found!\n\n", binkey);
-        exit(EXIT_FAILURE);
+        pthread_mutex_lock(&victim->lock);
+        remaining = victim->tail - victim->head;
+        steal = (remaining + 1) / 2;
+        end = victim->tail;
+        victim->tail -= steal;
+        start = victim->tail;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (steal) {
+            pthread_mutex_lock(&w->lock);
+            w->head = start + 1;
+            w->tail = end;
+            pthread_mutex_unlock(&w->lock);
+            unit = start;
+        }
     }
 
-    /* Get size of file */
-    stat(filename, &st);
-    size = get_aligned_size((sizeof(struct internal_use_area)+st.st_size), 8);
-    data = (char *) malloc(size);
+    return unit;
+}
 
-    /* Write format version */
-    iua = ((struct internal_use_area *) data);
-    iua->format_version = 0x01;
-                
-    flags = O_RDONLY;
-    if((fd = open(filename, flags)) == -1) {
-        fprintf(stderr, "\nUnable to open %s for reading!\n\n", filename);
-        exit(EXIT_FAILURE);
+void *run_batch_worker(void *arg)
+{
+    struct batch_worker *w = (struct batch_worker *) arg;
+    struct batch_job *job = w->job;
+    struct batch_unit *u;
+    struct fru_gen_ctx ctx;
+    struct fru_layout layout;
+    int i;
+
+    ctx = *job->tmpl;
+    memset(&ctx.own_arena, 0, sizeof(ctx.own_arena));
+    ctx.arena = &ctx.own_arena;
+    /* Without a cache of its own the worker just packs every value */
+    ctx.cache = NULL;
+    ctx.cache_hits = ctx.cache_misses = 0;
+    if (job->tmpl->cache) {
+        fru_cache_enable(&ctx);
     }
-    
-    int result = read(fd, iua->data, st.st_size);
-    if (result != st.st_size) {
-        fprintf(stdout,  "\nError reading entire file content!\n\n");
-        exit(EXIT_FAILURE);
+    ctx.ovr_keys = job->columns;
+    ctx.num_ovr = job->num_columns;
+
+    while ((i = take_batch_unit(w)) != -1) {
+        u = &job->units[i];
+        /* The output column never matches a config key */
+        ctx.ovr_vals = u->values;
+        if (job->compiled) {
+            if (fru_template_write(&ctx, job->compiled,
+                                   u->values[job->output_col]) < 0) {
+                u->error = strdup(fru_error(&ctx));
+            }
+        } else if (fru_layout_data(&ctx, &layout) ||
+            (job->max_size && fru_fit_layout(&ctx, &layout, job->max_size)) ||
+            fru_write_data(&ctx, &layout, u->values[job->output_col])) {
+            u->error = strdup(fru_error(&ctx));
+        }
+        fru_arena_reset(ctx.arena);
     }
-    
-    close(fd);
-    *iua_data = data;
 
-    return size;
+    w->cache_hits = ctx.cache_hits;
+    w->cache_misses = ctx.cache_misses;
+    fru_ctx_release(&ctx);
+
+    return NULL;
 }
 
-int gen_cia(dictionary *ini, char **cia_data)
+/* Generates one FRU data file per manifest row using 'num_workers'
+ * threads. The first row of the manifest names the columns: "output" is the
+ * FRU data file to write, every other column is a "section:key" whose value
+ * overrides the config for that row, or names a slot of 'compiled' when
+ * given. Results are reported in manifest order once all rows are
+ * done. Returns the number of rows that failed.
+ */
+int gen_fru_batch(struct fru_gen_ctx *tmpl,
+                  const struct fru_template *compiled, const char *manifest,
+                  int max_size, int num_workers)
 {
-    struct chassis_info_area *cia;
-    char *data,
-         *str_data,
-         *packed_ascii,
-         *key,
-         **sec_keys,
-         *part_num_packed,
-         *serial_num_packed;
-
-    int chassis_type,
-        size,
-        offset,
-        num_keys,
-        part_num_size,
-        serial_num_size,
-        packed_size,
-        i;
-
-    uint8_t end_marker, empty_marker, cksum;
-
-    cia = NULL;
-    size = offset = cksum = empty_marker = 0;
-    end_marker = 0xc1;
-
-    chassis_type = iniparser_getint(ini, get_key(CIA, CHASSIS_TYPE), 0);
-    if (!chassis_type) {
-        /* 0 is an illegal chassis type */
-        fprintf(stderr, "\nInvalid chassis type! Aborting\n\n");
-        exit(EXIT_FAILURE);
-    }
-    size += sizeof(struct chassis_info_area);
-
-    str_data = iniparser_getstring(ini, get_key(CIA, PART_NUMBER), NULL);
-    if (str_data && strlen(str_data)) {
-        part_num_size = (*packer)(str_data, &part_num_packed);
-        size += part_num_size;
-    } else {
-        /* predfined fields with no data take 1 byte (for type/length) */
-        part_num_packed = NULL;
-        size += 1;
+    FILE *fp;
+    char *line, **fields;
+    size_t line_size;
+    struct batch_job job;
+    struct batch_unit *u;
+    int max_fields, num_fields, max_units, num_units, lineno, created,
+        failed, per_worker, i;
+
+    line = NULL;
+    fields = NULL;
+    line_size = 0;
+    max_fields = max_units = num_units = lineno = created = failed = 0;
+
+    memset(&job, 0, sizeof(job));
+    job.tmpl = tmpl;
+    job.compiled = compiled;
+    job.max_size = max_size;
+    job.output_col = -1;
+
+    if (!(fp = fopen(manifest, "r"))) {
+        perror("Manifest open:");
+        return -1;
     }
 
-    str_data = iniparser_getstring(ini, get_key(CIA, SERIAL_NUMBER), NULL);
-    if (str_data && strlen(str_data)) {
-        serial_num_size = (*packer)(str_data, &serial_num_packed);
-        size += serial_num_size;
-    } else {
-        serial_num_packed = NULL;
-        size += 1;
-    }
+    while (getline(&line, &line_size, fp) != -1) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!*line) {
+            continue;
+        }
 
-    num_keys = iniparser_getsecnkeys(ini, CIA);
-    sec_keys = iniparser_getseckeys(ini, CIA);
+        if (!job.columns) {
+            /* header row, the column names are kept until we're done */
+            job.num_columns = split_csv_line(line, &fields, &max_fields);
+            job.header = line;
+            job.columns = fields;
+            fields = NULL;
+            max_fields = 0;
+            line = NULL;
+            line_size = 0;
+            for (i = 0; i < job.num_columns; i++) {
+                str_tolower(job.columns[i]);
+                if (!strcmp(job.columns[i], "output")) {
+                    job.output_col = i;
+                } else if (!compiled && !strchr(job.columns[i], ':')) {
+                    fprintf(stderr, "\nInvalid manifest column \"%s\", "
+                            "expected section:key\n\n", job.columns[i]);
+                    failed = -1;
+                } else if (compiled &&
+                           fru_template_find_slot(compiled,
+                                                  job.columns[i]) < 0) {
+                    fprintf(stderr, "\nManifest column \"%s\" is not a slot "
+                            "of the template\n\n", job.columns[i]);
+                    failed = -1;
+                }
+            }
+            if (job.output_col == -1) {
+                fprintf(stderr, "\nManifest %s has no \"output\" column\n\n",
+                        manifest);
+                failed = -1;
+            }
+            if (failed) {
+                break;
+            }
+            continue;
+        }
 
-    for (i = 0; i < num_keys; i++) {
-        key = sec_keys[i];
-        /* Skip keys we've already accounted for */
-        if (!strcmp(key, get_key(CIA, CHASSIS_TYPE)) ||
-            !strcmp(key, get_key(CIA, PART_NUMBER)) ||
-            !strcmp(key, get_key(CIA, SERIAL_NUMBER))) {
+        num_fields = split_csv_line(line, &fields, &max_fields);
+        if (num_fields != job.num_columns) {
+            fprintf(stderr, "\n%s:%d: expected %d values, found %d\n\n",
+                    manifest, lineno, job.num_columns, num_fields);
+            failed++;
             continue;
         }
-        str_data = iniparser_getstring(ini, key, NULL);
-        if (str_data && strlen(str_data)) {
-            size += (*packer)(str_data, &packed_ascii);
+
+        if (num_units == max_units) {
+            max_units = max_units ? max_units * 2 : 64;
+            job.units = (struct batch_unit *)
+                realloc(job.units, max_units * sizeof(struct batch_unit));
         }
+        u = &job.units[num_units++];
+        u->line = line;
+        u->values = fields;
+        u->lineno = lineno;
+        u->error = NULL;
+
+        /* the unit owns the line and its split values now */
+        line = NULL;
+        line_size = 0;
+        fields = NULL;
+        max_fields = 0;
     }
+    fclose(fp);
+
+    if (failed >= 0 && num_units) {
+        /* Keys the config doesn't have become custom fields. Add them
+         * before the workers start, so the config is only ever read
+         * concurrently.
+         */
+        for (i = 0; i < job.num_columns && !compiled; i++) {
+            if (i != job.output_col &&
+                !iniparser_find_entry(tmpl->ini, job.columns[i])) {
+                iniparser_set(tmpl->ini, job.columns[i], "");
+            }
+        }
 
-    /* 2 bytes added for chksum & and end marker */
-    size = get_aligned_size(size + 2, 8);
-
-    data = (char *) calloc(size, 1);
-    cia = (struct chassis_info_area *) data;
-
-    /* Fill up CIA */
-    cia->format_version = 0x01;
-    /* Length is in multiples of 8 bytes */
-    cia->area_length = size / 8;
-    cia->chassis_type = chassis_type;
-
-    if (part_num_packed) {
-        memcpy(cia->tl + offset, part_num_packed, part_num_size);
-        offset += part_num_size;
-    } else {
-        /* predfined fields with no data take 1 byte (for type/length) */
-        memcpy(cia->tl + offset, &empty_marker, 1);
-        offset += 1;
-    }
+        if (num_workers > num_units) {
+            num_workers = num_units;
+        }
+        job.num_workers = num_workers;
+        job.workers = (struct batch_worker *)
+            calloc(num_workers, sizeof(struct batch_worker));
+
+        /* start with an even split, stealing evens out the rest */
+        per_worker = num_units / num_workers;
+        for (i = 0; i < num_workers; i++) {
+            job.workers[i].job = &job;
+            job.workers[i].head = i * per_worker;
+            job.workers[i].tail = (i == num_workers - 1) ?
+                                  num_units : (i + 1) * per_worker;
+            pthread_mutex_init(&job.workers[i].lock, NULL);
+        }
 
-    if (serial_num_packed) {
-        memcpy(cia->tl + offset, serial_num_packed, serial_num_size);
-        offset += serial_num_size;
-    } else {
-        memcpy(cia->tl + offset, &empty_marker, 1);
-        offset += 1;
-    }
+        /* the calling thread is worker 0 */
+        for (i = 1; i < num_workers; i++) {
+            if (pthread_create(&job.workers[i].thread, NULL,
+                               run_batch_worker, &job.workers[i])) {
+                fprintf(stderr, "\nUnable to start worker thread %d\n\n", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+        run_batch_worker(&job.workers[0]);
+        for (i = 1; i < num_workers; i++) {
+            pthread_join(job.workers[i].thread, NULL);
+        }
 
-    for (i = 0; i < num_keys; i++) {
-        key = sec_keys[i];
-        /* Skip keys we've already accounted for */
-        if (!strcmp(key, get_key(CIA, CHASSIS_TYPE)) ||
-            !strcmp(key, get_key(CIA, PART_NUMBER)) ||
-            !strcmp(key, get_key(CIA, SERIAL_NUMBER))) {
-            continue;
+        for (i = 0; i < num_workers; i++) {
+            pthread_mutex_destroy(&job.workers[i].lock);
+            tmpl->cache_hits += job.workers[i].cache_hits;
+            tmpl->cache_misses += job.workers[i].cache_misses;
         }
-        str_data = iniparser_getstring(ini, key, NULL);
-        if (str_data && strlen(str_data)) {
-            packed_size = (*packer)(str_data, &packed_ascii);
-            memcpy(cia->tl + offset, packed_ascii, packed_size);
-            offset += packed_size;
+        free(job.workers);
+
+        for (i = 0; i < num_units; i++) {
+            u = &job.units[i];
+            if (u->error) {
+                fprintf(stderr, "\n%s:%d: %s\n\n", manifest, u->lineno,
+                        u->error);
+                failed++;
+            } else {
+                created++;
+            }
         }
     }
 
-    /* write the end marker 'C1' */
-    memcpy(cia->tl + offset, &end_marker, 1);
-    /* Calculate checksum of entire CIA */
-    cksum = get_zero_cksum((uint8_t *) data, size-1);
-    memcpy(data+size-1, &cksum, 1);
-
-    *cia_data = data;
+    for (i = 0; i < num_units; i++) {
+        free(job.units[i].line);
+        free(job.units[i].values);
+        free(job.units[i].error);
+    }
+    free(job.units);
+    free(job.header);
+    free(job.columns);
+    free(fields);
+    free(line);
+
+    if (failed >= 0) {
+        fprintf(stdout, "\n%d FRU files created from %s\n\n", created,
+                manifest);
+    }
 
-    return cia->area_length;
+    return failed;
 }
 
-int gen_bia(dictionary *ini, char **bia_data)
+/* Prints what libfru reports: information on stdout, warnings on stderr */
+void print_notice(void *arg, int warning, const char *msg)
 {
-    struct board_info_area *bia;
-
-    char *data,
-         *str_data,
-         *packed_ascii,
-         *mfg_packed,
-         *name_packed,
-         *serial_num_packed,
-         *part_num_packed,
-         *key,
-         **sec_keys;
-
-    int lang_code,
-        mfg_date,
-        size,
-        offset,
-        mfg_size,
-        name_size,
-        serial_num_size,
-        part_num_size,
-        num_keys,
-        packed_size,
-        i;
-
-    uint8_t end_marker, empty_marker, cksum;
-
-    bia = NULL;
-    size = offset = cksum = empty_marker = 0;
-    end_marker = 0xc1;
-
-    lang_code = iniparser_getint(ini, get_key(BIA, LANGUAGE_CODE), -1);
-    if (lang_code == -1) {
-        fprintf(stdout, "Board language code not specified. "
-                "Defaulting to English\n");
-        lang_code = 0;
-    }
-
-    mfg_date = iniparser_getint(ini, get_key(BIA, MFG_DATETIME), -1);
-    if (mfg_date == -1) {
-        fprintf(stdout, "Manufacturing time not specified. "
-                "Defaulting to unspecified\n");
-        mfg_date = 0;
-    }
-    size += sizeof(struct board_info_area);
-
-    str_data = iniparser_getstring(ini, get_key(BIA, MANUFACTURER), NULL);
-    if (str_data && strlen(str_data)) {
-        mfg_size = (*packer)(str_data, &mfg_packed);
-        size += mfg_size;
+    if (warning) {
+        fprintf(stderr, "\n%s\n\n", msg);
     } else {
-        mfg_packed = NULL;
-        size += 1;
+        fprintf(stdout, "%s\n", msg);
     }
+}
 
-    str_data = iniparser_getstring(ini, get_key(BIA, PRODUCT_NAME), NULL);
-    if (str_data && strlen(str_data)) {
-        name_size = (*packer)(str_data, &name_packed);
-        size += name_size;
-    } else {
-        name_packed = NULL;
-        size += 1;
-    }
+void print_cache_stats(unsigned long hits, unsigned long misses)
+{
+    unsigned long total = hits + misses;
 
-    str_data = iniparser_getstring(ini, get_key(BIA, SERIAL_NUMBER), NULL);
-    if (str_data && strlen(str_data)) {
-        serial_num_size = (*packer)(str_data, &serial_num_packed);
-        size += serial_num_size;
-    } else {
-        serial_num_packed = NULL;
-        size += 1;
+    fprintf(stdout, "\nPacking cache: %lu hits, %lu misses (%.1f%% hits)\n\n",
+            hits, misses, total ? 100.0 * hits / total : 0.0);
+}
+
+/* Generates from a compiled template, one file with -o or a file per row
+ * of the manifest, the -p "name=value" patches filling the slots for -o.
+ * Returns non-zero on failure, which is already reported.
+ */
+int gen_from_template(struct fru_gen_ctx *ctx,
+                      const struct fru_template *compiled, const char *name,
+                      const char *outfile, const char *manifest,
+                      char **patches, int num_patches, int num_workers)
+{
+    char **values, *value;
+    int result, i;
+
+    if (manifest) {
+        ctx->quiet = 1;
+        return gen_fru_batch(ctx, compiled, manifest, 0, num_workers);
     }
 
-    str_data = iniparser_getstring(ini, get_key(BIA, PART_NUMBER), NULL);
-    if (str_data && strlen(str_data)) {
-        part_num_size = (*packer)(str_data, &part_num_packed);
-        size += part_num_size;
-    } else {
-        part_num_packed = NULL;
-        size += 1;
-    }
-    /* We don't handle FRU File ID for now... */
-    size += 1;
-
-    num_keys = iniparser_getsecnkeys(ini, BIA);
-    sec_keys = iniparser_getseckeys(ini, BIA);
-
-    for (i = 0; i < num_keys; i++) {
-        key = sec_keys[i];
-        /* Skip keys we've already accounted for */
-        if (!strcmp(key, get_key(BIA, LANGUAGE_CODE)) ||
-            !strcmp(key, get_key(BIA, MFG_DATETIME)) ||
-            !strcmp(key, get_key(BIA, MANUFACTURER)) ||
-            !strcmp(key, get_key(BIA, PRODUCT_NAME)) ||
-            !strcmp(key, get_key(BIA, SERIAL_NUMBER)) ||
-            !strcmp(key, get_key(BIA, PART_NUMBER)) ||
-            !strcmp(key, get_key(BIA, FRU_FILE_ID))) {
-            continue;
+    values = (char **) calloc(num_patches + 1, sizeof(char *));
+    for (i = 0; i < num_patches; i++) {
+        value = strchr(patches[i], '=');
+        if (value) {
+            *value++ = '\0';
+            str_tolower(patches[i]);
         }
-        str_data = iniparser_getstring(ini, key, NULL);
-        if (str_data && strlen(str_data)) {
-            size += (*packer)(str_data, &packed_ascii);
+        if (!value || fru_template_find_slot(compiled, patches[i]) < 0) {
+            fprintf(stderr, "\n%s is not a slot of %s\n\n", patches[i],
+                    name);
+            free(values);
+            return -1;
         }
+        values[i] = value;
     }
 
-    size = get_aligned_size(size + 2, 8);
-
-    data = (char *) calloc(size, 1);
-    bia = (struct board_info_area *) data;
-
-    /* Fill up BIA */
-    bia->format_version = 0x01;
-    /* Length is in multiples of 8 bytes */
-    bia->area_length = size / 8;
-    bia->language_code = lang_code;
-    mfg_date = htole32(mfg_date);
-    memcpy(bia->mfg_date, &mfg_date, 3);
-
-    if (mfg_packed) {
-        memcpy(bia->tl + offset, mfg_packed, mfg_size);
-        offset += mfg_size;
+    ctx->ovr_keys = patches;
+    ctx->ovr_vals = values;
+    ctx->num_ovr = num_patches;
+    result = fru_template_write(ctx, compiled, outfile) < 0 ? -1 : 0;
+    if (result) {
+        fprintf(stderr, "\n%s\n\n", fru_error(ctx));
     } else {
-        /* predfined fields with no data take 1 byte (for type/length) */
-        memcpy(bia->tl + offset, &empty_marker, 1);
-        offset += 1;
+        fprintf(stdout, "\nFRU file \"%s\" created\n\n", outfile);
     }
+    ctx->num_ovr = 0;
+    free(values);
 
-    if (name_packed) {
-        memcpy(bia->tl + offset, name_packed, name_size);
-        offset += name_size;
-    } else {
-        memcpy(bia->tl + offset, &empty_marker, 1);
-        offset += 1;
-    }
+    return result;
+}
 
-    if (serial_num_packed) {
-        memcpy(bia->tl + offset, serial_num_packed, serial_num_size);
-        offset += serial_num_size;
-    } else {
-        memcpy(bia->tl + offset, &empty_marker, 1);
-        offset += 1;
-    }
+/* A config kept loaded by the server, with the context and arena reused by
+ * every request for it.
+ */
+struct serve_template {
+    const char          *name;      /* the -c argument */
+    struct fru_gen_ctx  ctx;
+    /* the config compiled, if it has placeholders, NULL 'hdr' otherwise */
+    struct fru_template compiled;
+};
 
-    if (part_num_packed) {
-        memcpy(bia->tl + offset, part_num_packed, part_num_size);
-        offset += part_num_size;
-    } else {
-        memcpy(bia->tl + offset, &empty_marker, 1);
-        offset += 1;
-    }
-    /* We don't handle FRU File ID for now... */
-    memcpy(bia->tl + offset, &empty_marker, 1);
-    offset += 1;
-
-    for (i = 0; i < num_keys; i++) {
-        key = sec_keys[i];
-        /* Skip keys we've already accounted for */
-        if (!strcmp(key, get_key(BIA, LANGUAGE_CODE)) ||
-            !strcmp(key, get_key(BIA, MFG_DATETIME)) ||
-            !strcmp(key, get_key(BIA, MANUFACTURER)) ||
-            !strcmp(key, get_key(BIA, PRODUCT_NAME)) ||
-            !strcmp(key, get_key(BIA, SERIAL_NUMBER)) ||
-            !strcmp(key, get_key(BIA, PART_NUMBER)) ||
-            !strcmp(key, get_key(BIA, FRU_FILE_ID))) {
-            continue;
-        }
-        str_data = iniparser_getstring(ini, key, NULL);
-        if (str_data && strlen(str_data)) {
-            packed_size = (*packer)(str_data, &packed_ascii);
-            memcpy(bia->tl + offset, packed_ascii, packed_size);
-            offset += packed_size;
+static volatile sig_atomic_t serve_stop;
+
+static void stop_serving(int sig)
+{
+    serve_stop = 1;
+}
+
+/* Sends all of 'len' bytes, without raising SIGPIPE if the client is gone */
+int send_full(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *) buf;
+    ssize_t n;
+
+    while (len) {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
         }
+        p += n;
+        len -= n;
     }
-    /* write the end marker 'C1' */
-    memcpy(bia->tl + offset, &end_marker, 1);
-    /* Calculate checksum of entire BIA */
-    cksum = get_zero_cksum((uint8_t *) data, size-1);
-    memcpy(data+size-1, &cksum, 1);
-
-    *bia_data = data;
 
-    return bia->area_length;
+    return 0;
 }
 
-int gen_pia(dictionary *ini, char **pia_data)
+int send_serve_error(int fd, const char *msg)
 {
-    struct product_info_area *pia;
-
-    char *data,
-         *str_data,
-         *packed_ascii,
-         *mfg_packed,
-         *name_packed,
-         *part_num_packed,
-         *version_packed,
-         *serial_num_packed,
-         *asset_tag_packed,
-         *key,
-         **sec_keys;
-
-    int lang_code,
-        size,
-        offset,
-        mfg_size,
-        name_size,
-        part_num_size,
-        version_size,
-        serial_num_size,
-        asset_tag_size,
-        packed_size,
-        num_keys,
-        i;
-
-    uint8_t end_marker, empty_marker, cksum;
-
-    pia = NULL;
-    size = offset = cksum = empty_marker = 0;
-    end_marker = 0xc1;
-
-    lang_code = iniparser_getint(ini, get_key(PIA, LANGUAGE_CODE), -1);
-    if (lang_code == -1) {
-        fprintf(stdout, "Product language code not specified. "
-                "Defaulting to English\n");
-        lang_code = 0;
-    }
-    size += sizeof(struct product_info_area);
-
-    str_data = iniparser_getstring(ini, get_key(PIA, MANUFACTURER), NULL);
-    if (str_data && strlen(str_data)) {
-        mfg_size = (*packer)(str_data, &mfg_packed);
-        size += mfg_size;
-    } else {
-        mfg_packed = NULL;
-        size += 1;
-    }
+    char reply[FRU_ERROR_SIZE + 8];
+    int len;
 
-    str_data = iniparser_getstring(ini, get_key(PIA, PRODUCT_NAME), NULL);
-    if (str_data && strlen(str_data)) {
-        name_size = (*packer)(str_data, &name_packed);
-        size += name_size;
-    } else {
-        /* predfined fields with no data take 1 byte (for type/length) */
-        name_packed = NULL;
-        size += 1;
+    len = snprintf(reply, sizeof(reply), "ERR %s\n", msg);
+    if (len >= (int) sizeof(reply)) {
+        len = sizeof(reply) - 1;
+        reply[len - 1] = '\n';
     }
 
-    str_data = iniparser_getstring(ini, get_key(PIA, PART_NUMBER), NULL);
-    if (str_data && strlen(str_data)) {
-        part_num_size = (*packer)(str_data, &part_num_packed);
-        size += part_num_size;
-    } else {
-        part_num_packed = NULL;
-        size += 1;
-    }
+    return send_full(fd, reply, len);
+}
 
-    str_data = iniparser_getstring(ini, get_key(PIA, VERSION), NULL);
-    if (str_data && strlen(str_data)) {
-        version_size = (*packer)(str_data, &version_packed);
-        size += version_size;
-    } else {
-        version_packed = NULL;
-        size += 1;
+/* Handles one request, a CSV line of the template, the output file and
+ * then "section:key=value" overrides, or "name=value" for the slots of a
+ * config with placeholders. With an empty output the FRU data
+ * follows the "OK <length>" reply line, otherwise it is written to the
+ * named file and only the reply line is sent.
+ */
+int serve_request(int fd, struct serve_template *templates,
+                  int num_templates, char *line, char ***fields,
+                  int *max_fields)
+{
+    struct serve_template *t;
+    struct fru_gen_ctx *ctx;
+    struct fru_layout layout;
+    char **keys, **vals, **added, reply[FRU_ERROR_SIZE], *end, *eq;
+    const char *output;
+    uint8_t *data;
+    int num_fields, num_ovr, num_added, length, index, result, i;
+
+    num_fields = split_csv_line(line, fields, max_fields);
+    if (num_fields < 2) {
+        return send_serve_error(fd, "Expected template,output[,S:K=VALUE...]");
     }
 
-    str_data = iniparser_getstring(ini, get_key(PIA, SERIAL_NUMBER), NULL);
-    if (str_data && strlen(str_data)) {
-        serial_num_size = (*packer)(str_data, &serial_num_packed);
-        size += serial_num_size;
+    t = NULL;
+    index = strtol((*fields)[0], &end, 10);
+    if (*(*fields)[0] && !*end) {
+        if (index >= 0 && index < num_templates) {
+            t = &templates[index];
+        }
     } else {
-        /* predfined fields with no data take 1 byte (for type/length) */
-        serial_num_packed = NULL;
-        size += 1;
+        for (i = 0; i < num_templates; i++) {
+            if (!strcmp(templates[i].name, (*fields)[0])) {
+                t = &templates[i];
+                break;
+            }
+        }
     }
-
-    str_data = iniparser_getstring(ini, get_key(PIA, ASSET_TAG), NULL);
-    if (str_data && strlen(str_data)) {
-        asset_tag_size = (*packer)(str_data, &asset_tag_packed);
-        size += asset_tag_size;
-    } else {
-        /* predfined fields with no data take 1 byte (for type/length) */
-        asset_tag_packed = NULL;
-        size += 1;
-    }
-    /* We don't handle FRU File ID for now... */
-    size += 1;
-
-    num_keys = iniparser_getsecnkeys(ini, PIA);
-    sec_keys = iniparser_getseckeys(ini, PIA);
-
-    /* first iteration calculates the amount of space needed */
-    for (i = 0; i < num_keys; i++) {
-        key = sec_keys[i];
-        /* Skip keys we've already accounted for */
-        if (!strcmp(key, get_key(PIA, LANGUAGE_CODE)) ||
-            !strcmp(key, get_key(PIA, MANUFACTURER)) ||
-            !strcmp(key, get_key(PIA, PRODUCT_NAME)) ||
-            !strcmp(key, get_key(PIA, PART_NUMBER)) ||
-            !strcmp(key, get_key(PIA, VERSION)) ||
-            !strcmp(key, get_key(PIA, SERIAL_NUMBER)) ||
-            !strcmp(key, get_key(PIA, ASSET_TAG)) ||
-            !strcmp(key, get_key(PIA, FRU_FILE_ID))) {
+    if (!t) {
+        return send_serve_error(fd, "Unknown template");
+    }
+    ctx = &t->ctx;
+    output = (*fields)[1];
+
+    /* the overrides point into the line, split at '=' */
+    keys = *fields + 2;
+    vals = (char **) malloc(num_fields * sizeof(char *));
+    added = (char **) malloc(num_fields * sizeof(char *));
+    num_ovr = num_fields - 2;
+    num_added = 0;
+    result = 0;
+
+    for (i = 0; i < num_ovr; i++) {
+        eq = strchr(keys[i], '=');
+        if (!eq || (!t->compiled.hdr && !memchr(keys[i], ':', eq - keys[i]))) {
+            result = send_serve_error(fd, "Expected S:K=VALUE overrides");
+            goto out;
+        }
+        *eq = '\0';
+        vals[i] = eq + 1;
+        str_tolower(keys[i]);
+        if (t->compiled.hdr) {
+            if (fru_template_find_slot(&t->compiled, keys[i]) < 0) {
+                snprintf(reply, sizeof(reply), "%s is not a slot of %s",
+                         keys[i], t->name);
+                result = send_serve_error(fd, reply);
+                goto out;
+            }
             continue;
         }
-        str_data = iniparser_getstring(ini, key, NULL);
-        if (str_data && strlen(str_data)) {
-            size += (*packer)(str_data, &packed_ascii);
+        /* Keys the config doesn't have become custom fields, but only for
+         * this request.
+         */
+        if (!iniparser_find_entry(ctx->ini, keys[i])) {
+            iniparser_set(ctx->ini, keys[i], "");
+            added[num_added++] = keys[i];
         }
     }
 
-    size = get_aligned_size(size + 2, 8);
+    ctx->ovr_keys = keys;
+    ctx->ovr_vals = vals;
+    ctx->num_ovr = num_ovr;
 
-    data = (char *) calloc(size, 1);
-    pia = (struct product_info_area *) data;
-
-    /* Fill up PIA */
-    pia->format_version = 0x01;
-    /* Length is in multiples of 8 bytes */
-    pia->area_length = size / 8;
-    pia->language_code = lang_code;
-
-    if (mfg_packed) {
-        memcpy(pia->tl + offset, mfg_packed, mfg_size);
-        offset += mfg_size;
-    } else {
-        memcpy(pia->tl + offset, &empty_marker, 1);
-        offset += 1;
-    }
-
-    if (name_packed) {
-        memcpy(pia->tl + offset, name_packed, name_size);
-        offset += name_size;
+    data = NULL;
+    if (t->compiled.hdr && *output) {
+        length = fru_template_write(ctx, &t->compiled, output);
+    } else if (t->compiled.hdr) {
+        /* only the slots are encoded, the rest is copied */
+        data = (uint8_t *) fru_arena_alloc(ctx->arena,
+                                           fru_template_length(&t->compiled));
+        length = fru_template_fill(ctx, &t->compiled, data);
+    } else if (*output) {
+        length = fru_layout_data(ctx, &layout) ||
+                 (ctx->max_size &&
+                  fru_fit_layout(ctx, &layout, ctx->max_size)) ||
+                 fru_write_data(ctx, &layout, output) ? -1 : layout.length;
     } else {
-        /* predfined fields with no data take 1 byte (for type/length) */
-        memcpy(pia->tl + offset, &empty_marker, 1);
-        offset += 1;
+        length = fru_encode(ctx, &data);
     }
 
-    if (part_num_packed) {
-        memcpy(pia->tl + offset, part_num_packed, part_num_size);
-        offset += part_num_size;
+    if (length < 0) {
+        result = send_serve_error(fd, fru_error(ctx));
     } else {
-        memcpy(pia->tl + offset, &empty_marker, 1);
-        offset += 1;
+        i = snprintf(reply, sizeof(reply), "OK %d\n", length);
+        result = send_full(fd, reply, i);
+        if (!result && !*output) {
+            result = send_full(fd, data, length);
+        }
     }
 
-    if (version_packed) {
-        memcpy(pia->tl + offset, version_packed, version_size);
-        offset += version_size;
-    } else {
-        memcpy(pia->tl + offset, &empty_marker, 1);
-        offset += 1;
-    }
+    ctx->num_ovr = 0;
+    fru_arena_reset(ctx->arena);
 
-    if (serial_num_packed) {
-        memcpy(pia->tl + offset, serial_num_packed, serial_num_size);
-        offset += serial_num_size;
-    } else {
-        memcpy(pia->tl + offset, &empty_marker, 1);
-        offset += 1;
+out:
+    for (i = 0; i < num_added; i++) {
+        iniparser_unset(ctx->ini, added[i]);
     }
+    free(added);
+    free(vals);
 
-    if (asset_tag_packed) {
-        memcpy(pia->tl + offset, asset_tag_packed, asset_tag_size);
-        offset += asset_tag_size;
-    } else {
-        memcpy(pia->tl + offset, &empty_marker, 1);
-        offset += 1;
-    }
-    /* We don't handle FRU File ID for now... */
-    memcpy(pia->tl + offset, &empty_marker, 1);
-    offset += 1;
-
-    /* Second iteration copies packed contents into final buffer */
-    for (i = 0; i < num_keys; i++) {
-        key = sec_keys[i];
-        /* Skip keys we've already accounted for */
-        if (!strcmp(key, get_key(PIA, LANGUAGE_CODE)) ||
-            !strcmp(key, get_key(PIA, MANUFACTURER)) ||
-            !strcmp(key, get_key(PIA, PRODUCT_NAME)) ||
-            !strcmp(key, get_key(PIA, PART_NUMBER)) ||
-            !strcmp(key, get_key(PIA, VERSION)) ||
-            !strcmp(key, get_key(PIA, SERIAL_NUMBER)) ||
-            !strcmp(key, get_key(PIA, ASSET_TAG)) ||
-            !strcmp(key, get_key(PIA, FRU_FILE_ID))) {
-            continue;
-        }
-        str_data = iniparser_getstring(ini, key, NULL);
-        if (str_data && strlen(str_data)) {
-            packed_size = (*packer)(str_data, &packed_ascii);
-            memcpy(pia->tl + offset, packed_ascii, packed_size);
-            offset += packed_size;
-        }
-    }
-    /* write the end marker 'C1' */
-    memcpy(pia->tl + offset, &end_marker, 1);
-    /* Calculate checksum of entire PIA */
-    cksum = get_zero_cksum((uint8_t *)data, size-1);
-    memcpy(data+size-1, &cksum, 1);
-
-    *pia_data = data;
-
-    return pia->area_length;
+    return result;
 }
 
-int gen_fru_data(dictionary *ini, char **raw_data)
+/* Serves FRU data generated from the configs in 'templates' over a Unix
+ * domain socket at 'path', until interrupted. Clients send one request per
+ * line and may keep the connection open for more. Returns non-zero if the
+ * socket couldn't be set up.
+ */
+int serve_fru_data(const char *path, struct serve_template *templates,
+                   int num_templates)
 {
-    int total_length,
-        offset,
-        len_mul8,
-        iua_len,
-        size,
-        cksum;
-
-    char *iua, *cia, *bia, *pia, *data;
-
-    iua = cia = bia = pia = data = NULL;
-    total_length = offset = len_mul8 = iua_len = size = cksum = 0;
-
-    /* A common header always exists even if there's no FRU data */
-    struct fru_common_header *fch =
-        (struct fru_common_header *) calloc(sizeof(struct fru_common_header),
-                                            1);
-    fch->format_version = 0x01;
-    total_length += sizeof(struct fru_common_header);
-    offset = total_length / 8;
-
-    /* Parse "Internal Use Area" (IUA) section */
-    if (iniparser_find_entry(ini, IUA)) {
-        iua_len = gen_iua(ini, &iua);
-        fch->internal_use_offset = offset;
-        offset += (iua_len/8);
-        total_length += iua_len;
-    }
-
-    /* Parse "Chassis Info Area" (CIA) section */
-    if (iniparser_find_entry(ini, CIA)) {
-        len_mul8 = gen_cia(ini, &cia);
-        fch->chassis_info_offset = offset;
-        offset += len_mul8;
-        total_length += len_mul8 * 8;
-    }
-
-    /* Parse "Board Info Area" (BIA) section */
-    if (iniparser_find_entry(ini, BIA)) {
-        len_mul8 = gen_bia(ini, &bia);
-        fch->board_info_offset = offset;
-        offset += len_mul8;
-        total_length += len_mul8 * 8;
-    }
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct stat st;
+    FILE *in;
+    char *line, **fields;
+    size_t line_size;
+    int sock, fd, max_fields, served;
 
-    /* Parse "Product Info Area" (PIA) section */
-    if (iniparser_find_entry(ini, PIA)) {
-        len_mul8 = gen_pia(ini, &pia);
-        fch->product_info_offset = offset;
-        offset += len_mul8;
-        total_length += len_mul8 * 8;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "\nSocket path %s is too long\n\n", path);
+        return -1;
     }
 
-    /* calculate header checksum */
-    cksum = get_zero_cksum((uint8_t *) fch, sizeof(*fch)-1);
-    fch->checksum = cksum;
-
-    data = (char *) malloc(total_length);
-
-    /* Copy common header first */
-    memcpy(data, fch, sizeof(struct fru_common_header));
-
-    /* Copy each section's data if any */
-    if (iua) {
-        offset = fch->internal_use_offset * 8;
-        size = *(iua + 1) * 8;
-        memcpy(data + offset, iua, size);
+    /* a socket left behind by an earlier server is replaced */
+    if (!stat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
     }
 
-    if (cia) {
-        offset = fch->chassis_info_offset * 8;
-        size = *(cia + 1) * 8;
-        memcpy(data + offset, cia, size);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+        bind(sock, (struct sockaddr *) &addr, sizeof(addr)) ||
+        listen(sock, 16)) {
+        fprintf(stderr, "\nError serving on %s: %s\n\n", path,
+                strerror(errno));
+        if (sock != -1) {
+            close(sock);
+        }
+        return -1;
     }
 
-    if (bia) {
-        offset = fch->board_info_offset * 8;
-        size = *(bia + 1) * 8;
-        memcpy(data + offset, bia, size);
-    }
+    /* no SA_RESTART, so a blocked accept() or read returns on a signal */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_serving;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    fprintf(stdout, "\nServing %d FRU template%s on %s\n\n", num_templates,
+            num_templates == 1 ? "" : "s", path);
+    fflush(stdout);
+
+    line = NULL;
+    fields = NULL;
+    line_size = 0;
+    max_fields = 0;
+    served = 0;
+
+    while (!serve_stop) {
+        if ((fd = accept(sock, NULL, NULL)) == -1) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                fprintf(stderr, "\nError accepting on %s: %s\n\n", path,
+                        strerror(errno));
+                break;
+            }
+            continue;
+        }
 
-    if (pia) {
-        offset = fch->product_info_offset * 8;
-        size = *(pia + 1) * 8;
-        memcpy(data + offset, pia, size);
+        /* replies are sent on 'fd' directly, 'in' only buffers requests */
+        if (!(in = fdopen(dup(fd), "r"))) {
+            close(fd);
+            continue;
+        }
+        while (!serve_stop && getline(&line, &line_size, in) != -1) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (!*line) {
+                continue;
+            }
+            if (serve_request(fd, templates, num_templates, line, &fields,
+                              &max_fields)) {
+                break;
+            }
+            served++;
+        }
+        fclose(in);
+        close(fd);
     }
 
-    *raw_data = data;
-
-    return total_length;
-}
-
-int write_fru_data(const char*filename, void *data, int length)
-{
-    int fd, flags;
-    mode_t mode;
+    close(sock);
+    unlink(path);
+    free(fields);
+    free(line);
 
-    fd = -1;
-    flags = O_RDWR | O_CREAT | O_TRUNC;
-    mode = S_IRWXU | S_IRGRP | S_IROTH;
-
-    if ((fd = open(filename, flags, mode)) == -1) {
-        perror("File open:");
-        return -1;
-    }
-
-    write(fd, data, length);
-    close(fd);
+    fprintf(stdout, "\n%d requests served\n\n", served);
 
     return 0;
 }
 
 int main(int argc, char **argv)
 {
-    char *fru_ini_file, *outfile, *data;
-    int c, length, max_size=0, result;
+    char *fru_ini_file, *outfile, *infile, *manifest, *device, *sock_path;
+    char *compile_file, *template_file;
+    char **patches, **configs;
+    int c, max_size=0, result, read_mode=0, num_workers=1, num_patches=0;
+    int keep_encoding=1, page_size=8, num_configs=0, cache_stats=0, i;
+    unsigned long cache_hits, cache_misses;
+    struct serve_template *templates;
     dictionary *ini;
+    struct fru_gen_ctx ctx;
+    struct fru_layout layout;
+    struct fru_template compiled;
 
     /* supported cmdline options */
-    char options[] = "hvri:aws:c:o:";
+    char options[] = "hvri:p:ae:ws:c:o:d:g:b:j:C:t:S";
 
-    fru_ini_file = outfile = data = NULL;
+    fru_ini_file = outfile = infile = manifest = device = sock_path = NULL;
+    compile_file = template_file = NULL;
     ini = NULL;
-    packer = &pack_ascii6;
+    patches = (char **) calloc(argc, sizeof(char *));
+    configs = (char **) calloc(argc, sizeof(char *));
+    fru_ctx_init(&ctx, NULL);
+    ctx.notify = print_notice;
 
-    while((c = getopt(argc, argv, options)) != -1) {
+    while((c = getopt_long(argc, argv, options, long_options, NULL)) != -1) {
         switch(c) {
             case 'r':
-                fprintf(stderr, "\nError! Option not implemented\n\n");
-                exit(EXIT_FAILURE);
+                read_mode = 1;
+                break;
             case 'i':
-                fprintf(stderr, "\nError! Option not implemented\n\n");
-                exit(EXIT_FAILURE);
+                infile = optarg;
+                break;
+            case 'p':
+                patches[num_patches++] = optarg;
+                break;
+            case 'w':
+                read_mode = 0;
+                break;
             case 's':
                 result = sscanf(optarg, "%d", &max_size);
                 if (result == 0 || result == EOF) {
@@ -899,12 +820,56 @@ int main(int argc, char **argv)
                 break;
             case 'c':
                 fru_ini_file = optarg;
+                configs[num_configs++] = optarg;
                 break;
             case 'o':
                 outfile = optarg;
                 break;
+            case 'd':
+                device = optarg;
+                break;
+            case 'g':
+                result = sscanf(optarg, "%d", &page_size);
+                if (result == 0 || result == EOF || page_size < 1) {
+                    fprintf(stderr, "\nError! Invalid page size (-g %s)\n\n",
+                            optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'a':
-                packer = &pack_ascii8;
+                fru_set_encoding(&ctx, "ascii8");
+                keep_encoding = 0;
+                break;
+            case 'e':
+                if (fru_set_encoding(&ctx, optarg)) {
+                    fprintf(stderr, "\nError! Unknown encoding (-e %s)\n\n",
+                            optarg);
+                    exit(EXIT_FAILURE);
+                }
+                keep_encoding = 0;
+                break;
+            case 'b':
+                manifest = optarg;
+                break;
+            case 'j':
+                result = sscanf(optarg, "%d", &num_workers);
+                if (result == 0 || result == EOF || num_workers < 1) {
+                    fprintf(stderr, "\nError! Invalid number of jobs (-j %s)\n\n",
+                            optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'C':
+                compile_file = optarg;
+                break;
+            case 't':
+                template_file = optarg;
+                break;
+            case 'S':
+                cache_stats = 1;
+                break;
+            case OPT_SERVE:
+                sock_path = optarg;
                 break;
 
             case 'v':
@@ -917,7 +882,125 @@ int main(int argc, char **argv)
         }
     }
 
-    if (!fru_ini_file || !outfile) {
+    if (read_mode) {
+        free(patches);
+        free(configs);
+        if (!infile) {
+            fprintf(stderr, usage, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (fru_read_data(&ctx, infile, stdout)) {
+            fprintf(stderr, "\n%s\n\n", fru_error(&ctx));
+            exit(EXIT_FAILURE);
+        }
+        fru_ctx_release(&ctx);
+        return 0;
+    }
+
+    if (template_file) {
+        if (!outfile && !manifest) {
+            fprintf(stderr, usage, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (fru_template_open(&ctx, template_file, &compiled)) {
+            fprintf(stderr, "\n%s\n\n", fru_error(&ctx));
+            exit(EXIT_FAILURE);
+        }
+
+        result = gen_from_template(&ctx, &compiled, template_file, outfile,
+                                   manifest, patches, num_patches,
+                                   num_workers);
+        fru_template_close(&compiled);
+        fru_ctx_release(&ctx);
+        free(patches);
+        free(configs);
+        if (result) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    /* with a config, -p fills its placeholders */
+    if (num_patches && !fru_ini_file) {
+        if (!infile) {
+            fprintf(stderr, usage, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (fru_patch_data(&ctx, infile, patches, num_patches,
+                           keep_encoding)) {
+            fprintf(stderr, "\n%s\n\n", fru_error(&ctx));
+            exit(EXIT_FAILURE);
+        }
+        free(patches);
+        free(configs);
+        fru_ctx_release(&ctx);
+        fprintf(stdout, "\nFRU file \"%s\" patched\n\n", infile);
+        return 0;
+    }
+
+    if (sock_path) {
+        free(patches);
+        if (!num_configs) {
+            fprintf(stderr, usage, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        /* every template starts from the options given on the command line */
+        ctx.quiet = 1;
+        ctx.max_size = max_size;
+        templates = (struct serve_template *)
+            calloc(num_configs, sizeof(struct serve_template));
+        for (i = 0; i < num_configs; i++) {
+            templates[i].name = configs[i];
+            templates[i].ctx = ctx;
+            memset(&templates[i].ctx.own_arena, 0,
+                   sizeof(templates[i].ctx.own_arena));
+            templates[i].ctx.arena = &templates[i].ctx.own_arena;
+            templates[i].ctx.cache = NULL;
+            if (fru_cache_enable(&templates[i].ctx)) {
+                fprintf(stderr, "\n%s\n\n", fru_error(&templates[i].ctx));
+                exit(EXIT_FAILURE);
+            }
+            templates[i].ctx.ini = iniparser_load(configs[i]);
+            if (!templates[i].ctx.ini) {
+                fprintf(stderr, "\nError parsing INI file %s!\n\n",
+                        configs[i]);
+                exit(EXIT_FAILURE);
+            }
+            if (fru_has_placeholders(&templates[i].ctx) &&
+                fru_template_compile(&templates[i].ctx,
+                                     &templates[i].compiled)) {
+                fprintf(stderr, "\n%s: %s\n\n", configs[i],
+                        fru_error(&templates[i].ctx));
+                exit(EXIT_FAILURE);
+            }
+            /* nothing compiling allocated is needed any more */
+            fru_arena_reset(templates[i].ctx.arena);
+        }
+        result = serve_fru_data(sock_path, templates, num_configs);
+        cache_hits = cache_misses = 0;
+        for (i = 0; i < num_configs; i++) {
+            cache_hits += templates[i].ctx.cache_hits;
+            cache_misses += templates[i].ctx.cache_misses;
+            if (templates[i].compiled.hdr) {
+                fru_template_close(&templates[i].compiled);
+            }
+            iniparser_freedict(templates[i].ctx.ini);
+            fru_ctx_release(&templates[i].ctx);
+        }
+        free(templates);
+        free(configs);
+        fru_ctx_release(&ctx);
+        if (cache_stats) {
+            print_cache_stats(cache_hits, cache_misses);
+        }
+        if (result) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+    free(configs);
+
+    if (!fru_ini_file || (!outfile && !manifest && !device && !compile_file)) {
         fprintf(stderr, usage, argv[0]);
         exit(EXIT_FAILURE);
     }
@@ -928,28 +1011,117 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    length = gen_fru_data(ini, &data);
+    ctx.ini = ini;
 
-    if (length < 0) {
-        fprintf(stderr, "\nError generating FRU data!\n\n");
+    /* the cache saves repacking the values that repeat across the rows of
+     * a batch, a single unit packs each value once and only gets it for -S
+     */
+    if ((manifest || cache_stats) && fru_cache_enable(&ctx)) {
+        fprintf(stderr, "\n%s\n\n", fru_error(&ctx));
+        exit(EXIT_FAILURE);
+    }
+
+    if (compile_file) {
+        ctx.max_size = max_size;
+        result = fru_compile(&ctx, compile_file);
+        if (result) {
+            fprintf(stderr, "\n%s\n\n", fru_error(&ctx));
+        } else {
+            fprintf(stdout, "\nFRU template \"%s\" compiled\n\n",
+                    compile_file);
+        }
+        fru_ctx_release(&ctx);
+        iniparser_freedict(ini);
+        free(patches);
+        if (result) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    if (fru_has_placeholders(&ctx)) {
+        if (device) {
+            fprintf(stderr, "\nPlaceholders can't be used with -d\n\n");
+            exit(EXIT_FAILURE);
+        }
+        /* the constant fields are encoded once, each unit fills the slots */
+        ctx.max_size = max_size;
+        ctx.quiet = manifest != NULL;
+        if (fru_template_compile(&ctx, &compiled)) {
+            fprintf(stderr, "\n%s\n\n", fru_error(&ctx));
+            exit(EXIT_FAILURE);
+        }
+        result = gen_from_template(&ctx, &compiled, fru_ini_file, outfile,
+                                   manifest, patches, num_patches,
+                                   num_workers);
+        fru_template_close(&compiled);
+        fru_ctx_release(&ctx);
+        iniparser_freedict(ini);
+        free(patches);
+        if (cache_stats) {
+            print_cache_stats(ctx.cache_hits, ctx.cache_misses);
+        }
+        if (result) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    if (num_patches) {
+        fprintf(stderr, "\n-p needs -i, -t or a config with placeholders"
+                "\n\n");
+        exit(EXIT_FAILURE);
+    }
+    free(patches);
+
+    if (manifest) {
+        /* the same notices would otherwise be repeated for every unit */
+        ctx.quiet = 1;
+        result = gen_fru_batch(&ctx, NULL, manifest, max_size,
+                               num_workers);
+        fru_ctx_release(&ctx);
+        if (cache_stats) {
+            print_cache_stats(ctx.cache_hits, ctx.cache_misses);
+        }
+        iniparser_freedict(ini);
+        if (result) {
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    if (fru_layout_data(&ctx, &layout)) {
+        fprintf(stderr, "\n%s\n\n", fru_error(&ctx));
         exit(EXIT_FAILURE);
     }
 
     // only bother checking max_size if the parameter set it
-    if (max_size  && (length > max_size)) {
-        fprintf(stderr, "\nError! FRU data length (%d bytes) exceeds maximum "
-                "file size (%d bytes)\n\n", length, max_size);
+    if (max_size && fru_fit_layout(&ctx, &layout, max_size)) {
+        fprintf(stderr, "\nError! %s\n\n", fru_error(&ctx));
         exit(EXIT_FAILURE);
     }
     
-    if (write_fru_data(outfile, data, length)) {
-        fprintf(stderr, "\nError writing %s\n\n", outfile);
+    if (device) {
+        if (fru_program_device(&ctx, &layout, device, page_size)) {
+            fprintf(stderr, "\n%s\n\n", fru_error(&ctx));
+            exit(EXIT_FAILURE);
+        }
+    } else if (fru_write_data(&ctx, &layout, outfile)) {
+        fprintf(stderr, "\n%s\n\n", fru_error(&ctx));
         exit(EXIT_FAILURE);
     }
     
+    fru_ctx_release(&ctx);
     iniparser_freedict(ini);
 
-    fprintf(stdout, "\nFRU file \"%s\" created\n\n", outfile);
+    if (device) {
+        fprintf(stdout, "\nFRU device \"%s\" programmed\n\n", device);
+    } else {
+        fprintf(stdout, "\nFRU file \"%s\" created\n\n", outfile);
+    }
+    if (cache_stats) {
+        print_cache_stats(ctx.cache_hits, ctx.cache_misses);
+    }
 
     return 0;
 }
@@ -29,6 +29,10 @@
 /** Invalid key token */
 #define DICT_INVALID_KEY    ((char*)-1)
 
+/** Markers for unused hash index buckets */
+#define DICT_BUCKET_EMPTY   (-1)
+#define DICT_BUCKET_DELETED (-2)
+
 /*---------------------------------------------------------------------------
                             Private functions
  ---------------------------------------------------------------------------*/
@@ -70,6 +74,90 @@ static char * xstrdup(const char * s)
     return t ;
 }
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Find the index bucket of a key.
+  @param    d       dictionary object to search.
+  @param    key     Key to look for.
+  @param    hash    Hash value of the key.
+  @return   Bucket holding the key's slot, or -1 if not found.
+
+  Buckets are probed linearly from the key's home bucket. Tombstones left
+  by dictionary_unset() are skipped, an empty bucket ends the search.
+ */
+/*--------------------------------------------------------------------------*/
+static int dictionary_lookup(dictionary * d, const char * key, unsigned hash)
+{
+    unsigned    mask ;
+    unsigned    b ;
+    int         slot ;
+
+    mask = d->isize - 1 ;
+    for (b = hash & mask ; (slot = d->index[b]) != DICT_BUCKET_EMPTY ;
+         b = (b + 1) & mask) {
+        if (slot == DICT_BUCKET_DELETED)
+            continue ;
+        if (hash==d->hash[slot] && !strcmp(key, d->key[slot]))
+            return (int)b ;
+    }
+    return -1 ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Add a slot to the hash index.
+  @param    d       dictionary object to modify.
+  @param    slot    Slot of an entry not in the index yet.
+  @return   void
+
+  The first empty or deleted bucket in probe order is used. The caller
+  makes sure the index has room.
+ */
+/*--------------------------------------------------------------------------*/
+static void dictionary_index_add(dictionary * d, int slot)
+{
+    unsigned    mask ;
+    unsigned    b ;
+
+    mask = d->isize - 1 ;
+    for (b = d->hash[slot] & mask ; d->index[b] >= 0 ; b = (b + 1) & mask)
+        ;
+    if (d->index[b] == DICT_BUCKET_EMPTY)
+        d->iused ++ ;
+    d->index[b] = slot ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Rebuild the hash index.
+  @param    d       dictionary object to modify.
+  @param    isize   New number of buckets, a power of 2.
+  @return   int     0 if Ok, -1 if the index cannot be allocated.
+
+  All tombstones are dropped in the process.
+ */
+/*--------------------------------------------------------------------------*/
+static int dictionary_reindex(dictionary * d, int isize)
+{
+    int     *   index ;
+    int         i ;
+
+    index = (int *)malloc(isize * sizeof(int));
+    if (index==NULL)
+        return -1 ;
+    for (i=0 ; i<isize ; i++)
+        index[i] = DICT_BUCKET_EMPTY ;
+    free(d->index);
+    d->index = index ;
+    d->isize = isize ;
+    d->iused = 0 ;
+    for (i=0 ; i<d->size ; i++) {
+        if (d->key[i]!=NULL)
+            dictionary_index_add(d, i);
+    }
+    return 0 ;
+}
+
 /*---------------------------------------------------------------------------
                             Function codes
  ---------------------------------------------------------------------------*/
@@ -128,6 +216,17 @@ dictionary * dictionary_new(int size)
     d->val  = (char **)calloc(size, sizeof(char*));
     d->key  = (char **)calloc(size, sizeof(char*));
     d->hash = (unsigned int *)calloc(size, sizeof(unsigned));
+    /* Keep the index at most half full, tombstones included */
+    for (d->isize=1 ; d->isize < 2*size ; d->isize *= 2)
+        ;
+    if (d->val==NULL || d->key==NULL || d->hash==NULL ||
+        dictionary_reindex(d, d->isize)) {
+        free(d->val);
+        free(d->key);
+        free(d->hash);
+        free(d);
+        return NULL ;
+    }
     return d ;
 }
 
@@ -154,6 +253,12 @@ void dictionary_del(dictionary * d)
     free(d->val);
     free(d->key);
     free(d->hash);
+    free(d->index);
+    free(d->shead);
+    free(d->snext);
+    free(d->sprev);
+    free(d->stail);
+    free(d->scount);
     free(d);
     return ;
 }
@@ -174,22 +279,31 @@ void dictionary_del(dictionary * d)
 /*--------------------------------------------------------------------------*/
 char * dictionary_get(dictionary * d, const char * key, char * def)
 {
-    unsigned    hash ;
-    int         i ;
+    int         b ;
 
-    hash = dictionary_hash(key);
-    for (i=0 ; i<d->size ; i++) {
-        if (d->key[i]==NULL)
-            continue ;
-        /* Compare hash */
-        if (hash==d->hash[i]) {
-            /* Compare string, to avoid hash collisions */
-            if (!strcmp(key, d->key[i])) {
-                return d->val[i] ;
-            }
-        }
-    }
-    return def ;
+    b = dictionary_lookup(d, key, dictionary_hash(key));
+    if (b<0)
+        return def ;
+    return d->val[d->index[b]] ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Get the slot of a key in a dictionary.
+  @param    d       dictionary object to search.
+  @param    key     Key to look for in the dictionary.
+  @return   int     Slot of the key in d->key/d->val, -1 if not found.
+ */
+/*--------------------------------------------------------------------------*/
+int dictionary_getslot(dictionary * d, const char * key)
+{
+    int         b ;
+
+    if (d==NULL || key==NULL) return -1 ;
+    b = dictionary_lookup(d, key, dictionary_hash(key));
+    if (b<0)
+        return -1 ;
+    return d->index[b] ;
 }
 
 /*-------------------------------------------------------------------------*/
@@ -221,6 +335,7 @@ char * dictionary_get(dictionary * d, const char * key, char * def)
 int dictionary_set(dictionary * d, const char * key, const char * val)
 {
     int         i ;
+    int         b ;
     unsigned    hash ;
 
     if (d==NULL || key==NULL) return -1 ;
@@ -229,19 +344,15 @@ int dictionary_set(dictionary * d, const char * key, const char * val)
     hash = dictionary_hash(key) ;
     /* Find if value is already in dictionary */
     if (d->n>0) {
-        for (i=0 ; i<d->size ; i++) {
-            if (d->key[i]==NULL)
-                continue ;
-            if (hash==d->hash[i]) { /* Same hash value */
-                if (!strcmp(key, d->key[i])) {   /* Same key */
-                    /* Found a value: modify and return */
-                    if (d->val[i]!=NULL)
-                        free(d->val[i]);
-                    d->val[i] = val ? xstrdup(val) : NULL ;
-                    /* Value has been modified: return */
-                    return 0 ;
-                }
-            }
+        b = dictionary_lookup(d, key, hash);
+        if (b>=0) {
+            /* Found a value: modify and return */
+            i = d->index[b] ;
+            if (d->val[i]!=NULL)
+                free(d->val[i]);
+            d->val[i] = val ? xstrdup(val) : NULL ;
+            /* Value has been modified: return */
+            return 0 ;
         }
     }
     /* Add a new value */
@@ -258,6 +369,12 @@ int dictionary_set(dictionary * d, const char * key, const char * val)
         }
         /* Double size */
         d->size *= 2 ;
+        if (dictionary_reindex(d, 2*d->isize))
+            return -1 ;
+    } else if (2*(d->iused+1) > d->isize) {
+        /* Too many tombstones: rebuild without them */
+        if (dictionary_reindex(d, d->isize))
+            return -1 ;
     }
 
     /* Insert key in the first empty slot. Start at d->n and wrap at
@@ -270,7 +387,9 @@ int dictionary_set(dictionary * d, const char * key, const char * val)
     d->key[i]  = xstrdup(key);
     d->val[i]  = val ? xstrdup(val) : NULL ;
     d->hash[i] = hash;
+    dictionary_index_add(d, i);
     d->n ++ ;
+    d->gen ++ ;
     return 0 ;
 }
 
@@ -287,30 +406,22 @@ int dictionary_set(dictionary * d, const char * key, const char * val)
 /*--------------------------------------------------------------------------*/
 void dictionary_unset(dictionary * d, const char * key)
 {
-    unsigned    hash ;
+    int         b ;
     int         i ;
 
     if (key == NULL) {
         return;
     }
 
-    hash = dictionary_hash(key);
-    for (i=0 ; i<d->size ; i++) {
-        if (d->key[i]==NULL)
-            continue ;
-        /* Compare hash */
-        if (hash==d->hash[i]) {
-            /* Compare string, to avoid hash collisions */
-            if (!strcmp(key, d->key[i])) {
-                /* Found key */
-                break ;
-            }
-        }
-    }
-    if (i>=d->size)
+    b = dictionary_lookup(d, key, dictionary_hash(key));
+    if (b<0)
         /* Key not found */
         return ;
 
+    /* Leave a tombstone so that probing continues past this bucket */
+    i = d->index[b] ;
+    d->index[b] = DICT_BUCKET_DELETED ;
+
     free(d->key[i]);
     d->key[i] = NULL ;
     if (d->val[i]!=NULL) {
@@ -319,6 +430,7 @@ void dictionary_unset(dictionary * d, const char * key)
     }
     d->hash[i] = 0 ;
     d->n -- ;
+    d->gen ++ ;
     return ;
 }
 
@@ -33,9 +33,10 @@
   @brief    Dictionary object
 
   This object contains a list of string/string associations. Each
-  association is identified by a unique string key. Looking up values
-  in the dictionary is speeded up by the use of a (hopefully collision-free)
-  hash function.
+  association is identified by a unique string key. Entries are stored in
+  insertion order in the key/val/hash lists. An open-addressed hash table
+  of slot numbers (index) finds the entry for a key in constant expected
+  time.
  */
 /*-------------------------------------------------------------------------*/
 typedef struct _dictionary_ {
@@ -44,6 +45,17 @@ typedef struct _dictionary_ {
     char        **  val ;   /** List of string values */
     char        **  key ;   /** List of string keys */
     unsigned     *  hash ;  /** List of hash values for keys */
+    int          *  index ; /** Hash table of slots in key/val/hash */
+    int             isize ; /** Number of buckets in index, a power of 2 */
+    int             iused ; /** Buckets holding an entry or a tombstone */
+    unsigned        gen ;   /** Bumped whenever a key is added or removed */
+    /* Section index, maintained by iniparser (see iniparser_getseckeys) */
+    unsigned        sgen ;  /** Value of gen the section index is valid for */
+    int          *  shead ; /** First key slot of a section slot, or -1 */
+    int          *  snext ; /** Next key slot in the same section, or -1 */
+    int          *  sprev ; /** Previous key slot in the same section, or -1 */
+    int          *  stail ; /** Last key slot of a section slot, or -1 */
+    int          *  scount ;/** Number of keys of a section slot */
 } dictionary ;
 
 
@@ -106,6 +118,16 @@ void dictionary_del(dictionary * vd);
 char * dictionary_get(dictionary * d, const char * key, char * def);
 
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Get the slot of a key in a dictionary.
+  @param    d       dictionary object to search.
+  @param    key     Key to look for in the dictionary.
+  @return   int     Slot of the key in d->key/d->val, -1 if not found.
+ */
+/*--------------------------------------------------------------------------*/
+int dictionary_getslot(dictionary * d, const char * key);
+
 /*-------------------------------------------------------------------------*/
 /**
   @brief    Set a value in a dictionary.
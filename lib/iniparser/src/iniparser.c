@@ -7,7 +7,13 @@
 */
 /*--------------------------------------------------------------------------*/
 /*---------------------------- Includes ------------------------------------*/
+#define _POSIX_C_SOURCE 200112L
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include "iniparser.h"
 
 /*---------------------------- Defines -------------------------------------*/
@@ -29,66 +35,64 @@ typedef enum _line_status_ {
     LINE_VALUE
 } line_status ;
 
+/**
+ * A growable, nul-terminated string buffer (internal use only).
+ */
+typedef struct _inibuf_ {
+    char    *   s ;     /** Contents, NULL until first used */
+    size_t      len ;   /** Length of the contents */
+    size_t      size ;  /** Allocated size */
+} inibuf ;
+
 /*-------------------------------------------------------------------------*/
 /**
   @brief    Convert a string to lowercase.
-  @param    s   String to convert.
-  @return   ptr to statically allocated string.
+  @param    in   String to convert.
+  @param    out  Output buffer.
+  @param    len  Size of the out buffer.
+  @return   ptr to the out buffer or NULL if an error occured.
 
-  This function returns a pointer to a statically allocated string
-  containing a lowercased version of the input string. Do not free
-  or modify the returned string! Since the returned string is statically
-  allocated, it will be modified at each function call (not re-entrant).
+  This function convert a string into lowercase.
+  At most len - 1 elements of the input string will be converted.
  */
 /*--------------------------------------------------------------------------*/
-static char * strlwc(const char * s)
+static char * strlwc(const char * in, char *out, unsigned len)
 {
-    static char l[ASCIILINESZ+1];
-    int i ;
+    unsigned i ;
 
-    if (s==NULL) return NULL ;
-    memset(l, 0, ASCIILINESZ+1);
+    if (in==NULL || out==NULL || len==0) return NULL ;
     i=0 ;
-    while (s[i] && i<ASCIILINESZ) {
-        l[i] = (char)tolower((int)s[i]);
+    while (in[i] != '\0' && i < len-1) {
+        out[i] = (char)tolower((int)in[i]);
         i++ ;
     }
-    l[ASCIILINESZ]=(char)0;
-    return l ;
+    out[i] = '\0';
+    return out ;
 }
 
 /*-------------------------------------------------------------------------*/
 /**
-  @brief    Remove blanks at the beginning and the end of a string.
-  @param    s   String to parse.
-  @return   ptr to statically allocated string.
-
-  This function returns a pointer to a statically allocated string,
-  which is identical to the input string, except that all blank
-  characters at the end and the beg. of the string have been removed.
-  Do not free or modify the returned string! Since the returned string
-  is statically allocated, it will be modified at each function call
-  (not re-entrant).
+  @brief    Convert a string of any length to lowercase.
+  @param    in      String to convert.
+  @param    buf     Buffer to use when the string fits.
+  @param    len     Size of buf.
+  @return   ptr to the lowercased string, NULL if it cannot be allocated.
+
+  Unlike strlwc(), nothing is cut: a string that does not fit in buf is
+  lowercased into an allocated copy. The caller frees the returned
+  pointer when it is not buf.
  */
 /*--------------------------------------------------------------------------*/
-static char * strstrip(const char * s)
+static char * strlwc_key(const char * in, char * buf, unsigned len)
 {
-    static char l[ASCIILINESZ+1];
-    char * last ;
-    
-    if (s==NULL) return NULL ;
-    
-    while (isspace((int)*s) && *s) s++;
-    memset(l, 0, ASCIILINESZ+1);
-    strcpy(l, s);
-    last = l + strlen(l);
-    while (last > l) {
-        if (!isspace((int)*(last-1)))
-            break ;
-        last -- ;
-    }
-    *last = (char)0;
-    return (char*)l ;
+    size_t  n ;
+    char *  out ;
+
+    if (in==NULL) return NULL ;
+    n = strlen(in);
+    out = n<len ? buf : (char *)malloc(n+1);
+    if (out==NULL) return NULL ;
+    return strlwc(in, out, (unsigned)n+1);
 }
 
 /*-------------------------------------------------------------------------*/
@@ -269,35 +273,243 @@ void iniparser_dumpsection_ini(dictionary * d, char * s, FILE * f)
 
 /*-------------------------------------------------------------------------*/
 /**
-  @brief    Get the number of keys in a section of a dictionary.
+  @brief    Find the section a key belongs to
   @param    d   Dictionary to examine
-  @param    s   Section name of dictionary to examine
-  @return   Number of keys in section
+  @param    key Key to look for, as "section:key"
+  @return   Slot of the section entry, -1 if there is none, -2 if the
+            section name cannot be allocated.
+
+  Section names may contain colons themselves, so the key belongs to
+  the longest prefix, ending before one of its colons, that is a
+  section. Sections are the entries with a NULL value.
  */
 /*--------------------------------------------------------------------------*/
-int iniparser_getsecnkeys(dictionary * d, const char * s)
+static int iniparser_keysec(dictionary * d, const char * key)
 {
-    int     seclen, nkeys ;
-    char    keym[ASCIILINESZ+1];
-    int j ;
+    char    buf[ASCIILINESZ+1];
+    char *  secname ;
+    int     len, sec ;
 
-    nkeys = 0;
+    for (len=(int)strlen(key)-1 ; len>=0 ; len--) {
+        if (key[len]!=':')
+            continue ;
+        secname = len<(int)sizeof(buf) ? buf : (char *)malloc(len+1);
+        if (secname==NULL)
+            return -2 ;
+        memcpy(secname, key, len);
+        secname[len] = '\0' ;
+        sec = dictionary_getslot(d, secname);
+        if (secname!=buf)
+            free(secname);
+        if (sec>=0 && d->val[sec]==NULL)
+            return sec ;
+    }
+    return -1 ;
+}
 
-    if (d==NULL) return nkeys;
-    if (! iniparser_find_entry(d, s)) return nkeys;
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Add a key slot to the section index
+  @param    d   Dictionary to modify
+  @param    i   Slot of the key
+  @return   int 0 if Ok, -1 if the section of the key cannot be found.
 
-    seclen  = (int)strlen(s);
-    sprintf(keym, "%s:", s);
+  The key is linked into its section in slot order. New keys usually
+  get the highest slot, so the walk back from the tail stops at once.
+ */
+/*--------------------------------------------------------------------------*/
+static int iniparser_link_key(dictionary * d, int i)
+{
+    int sec, j ;
+
+    d->snext[i] = d->sprev[i] = -1 ;
+    if (strchr(d->key[i], ':')==NULL)
+        return 0 ;
+    sec = iniparser_keysec(d, d->key[i]);
+    if (sec==-2)
+        return -1 ;
+    if (sec<0)
+        return 0 ;
+
+    for (j=d->stail[sec] ; j>i ; j=d->sprev[j])
+        ;
+    d->sprev[i] = j ;
+    if (j<0) {
+        d->snext[i] = d->shead[sec] ;
+        d->shead[sec] = i ;
+    } else {
+        d->snext[i] = d->snext[j] ;
+        d->snext[j] = i ;
+    }
+    if (d->snext[i]<0)
+        d->stail[sec] = i ;
+    else
+        d->sprev[d->snext[i]] = i ;
+    d->scount[sec]++ ;
+    return 0 ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Remove a key slot from the section index
+  @param    d   Dictionary to modify
+  @param    i   Slot of the key
+  @return   int 0 if Ok, -1 if the section of the key cannot be found.
+ */
+/*--------------------------------------------------------------------------*/
+static int iniparser_unlink_key(dictionary * d, int i)
+{
+    int sec ;
+
+    if (strchr(d->key[i], ':')==NULL)
+        return 0 ;
+    sec = iniparser_keysec(d, d->key[i]);
+    if (sec==-2)
+        return -1 ;
+    if (sec<0)
+        return 0 ;
+    if (d->sprev[i]<0)
+        d->shead[sec] = d->snext[i] ;
+    else
+        d->snext[d->sprev[i]] = d->snext[i] ;
+    if (d->snext[i]<0)
+        d->stail[sec] = d->sprev[i] ;
+    else
+        d->sprev[d->snext[i]] = d->sprev[i] ;
+    d->snext[i] = d->sprev[i] = -1 ;
+    d->scount[sec]-- ;
+    return 0 ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Rebuild the section index of a dictionary
+  @param    d   Dictionary to index
+  @return   int 0 if Ok, -1 if the index cannot be allocated.
+
+  The section index links the keys of each section in slot order, so
+  that section enumeration does not have to look at every entry of the
+  dictionary. It is built by iniparser_load(). iniparser_set() and
+  iniparser_unset() update it in place for keys and only rebuild it
+  when a section is added or removed or the dictionary grows, so that
+  lookups never modify the dictionary and can run concurrently.
+ */
+/*--------------------------------------------------------------------------*/
+static int iniparser_index_sections(dictionary * d)
+{
+    int     i ;
 
+    if (d==NULL)
+        return -1 ;
+
+    free(d->shead);
+    free(d->snext);
+    free(d->sprev);
+    free(d->stail);
+    free(d->scount);
+    d->shead  = (int *)malloc(d->size * sizeof(int));
+    d->snext  = (int *)malloc(d->size * sizeof(int));
+    d->sprev  = (int *)malloc(d->size * sizeof(int));
+    d->stail  = (int *)malloc(d->size * sizeof(int));
+    d->scount = (int *)calloc(d->size, sizeof(int));
+    if (d->shead==NULL || d->snext==NULL || d->sprev==NULL ||
+        d->stail==NULL || d->scount==NULL)
+        goto fail ;
+
+    for (i=0 ; i<d->size ; i++) {
+        d->shead[i] = d->snext[i] = d->sprev[i] = d->stail[i] = -1 ;
+    }
+    for (i=0 ; i<d->size ; i++) {
+        if (d->key[i]!=NULL && iniparser_link_key(d, i))
+            goto fail ;
+    }
+    d->sgen = d->gen ;
+    return 0 ;
+
+fail:
+    free(d->shead);
+    free(d->snext);
+    free(d->sprev);
+    free(d->stail);
+    free(d->scount);
+    d->shead = d->snext = d->sprev = d->stail = d->scount = NULL ;
+    return -1 ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Find the slot of a section
+  @param    d   Dictionary to examine
+  @param    s   Section name of dictionary to examine
+  @return   Slot of the section entry, -1 if there is no such section
+ */
+/*--------------------------------------------------------------------------*/
+static int iniparser_secslot(dictionary * d, const char * s)
+{
+    char    buf[ASCIILINESZ+1];
+    char *  secname ;
+    int     sec ;
+
+    if (d==NULL || s==NULL) return -1 ;
+    secname = strlwc_key(s, buf, sizeof(buf));
+    if (secname==NULL) return -1 ;
+    sec = dictionary_getslot(d, secname);
+    if (secname!=buf)
+        free(secname);
+    return sec ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Collect the keys of a section without the section index
+  @param    d       Dictionary to examine
+  @param    sec     Slot of the section entry
+  @param    keys    Array to fill with the keys, or NULL to only count
+  @return   Number of keys in section
+
+  Fallback for a dictionary whose section index is out of date, e.g.
+  because it was modified with dictionary_set() directly. Keys are
+  assigned to sections by the same rule as the index.
+ */
+/*--------------------------------------------------------------------------*/
+static int iniparser_scan_section(dictionary * d, int sec, char ** keys)
+{
+    int     seclen, nkeys ;
+    int     j ;
+
+    seclen = (int)strlen(d->key[sec]);
+    nkeys  = 0 ;
     for (j=0 ; j<d->size ; j++) {
         if (d->key[j]==NULL)
             continue ;
-        if (!strncmp(d->key[j], strlwc(keym), seclen+1))
+        if (!strncmp(d->key[j], d->key[sec], seclen) &&
+            d->key[j][seclen]==':' &&
+            iniparser_keysec(d, d->key[j])==sec) {
+            if (keys!=NULL)
+                keys[nkeys] = d->key[j];
             nkeys++;
+        }
     }
+    return nkeys ;
+}
 
-    return nkeys;
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Get the number of keys in a section of a dictionary.
+  @param    d   Dictionary to examine
+  @param    s   Section name of dictionary to examine
+  @return   Number of keys in section
+ */
+/*--------------------------------------------------------------------------*/
+int iniparser_getsecnkeys(dictionary * d, const char * s)
+{
+    int sec ;
 
+    sec = iniparser_secslot(d, s);
+    if (sec<0) return 0 ;
+    if (d->shead==NULL || d->sgen!=d->gen)
+        return iniparser_scan_section(d, sec, NULL);
+    return d->scount[sec] ;
 }
 
 /*-------------------------------------------------------------------------*/
@@ -319,31 +531,26 @@ char ** iniparser_getseckeys(dictionary * d, const char * s)
 
     char **keys;
 
-    int i, j ;
-    char    keym[ASCIILINESZ+1];
-    int     seclen, nkeys ;
-
-    keys = NULL;
+    int i, j, sec ;
 
-    if (d==NULL) return keys;
-    if (! iniparser_find_entry(d, s)) return keys;
+    sec = iniparser_secslot(d, s);
+    if (sec<0) return NULL ;
 
-    nkeys = iniparser_getsecnkeys(d, s);
+    if (d->shead==NULL || d->sgen!=d->gen) {
+        keys = (char**) malloc(iniparser_scan_section(d, sec, NULL)
+                               * sizeof(char*));
+        if (keys!=NULL)
+            iniparser_scan_section(d, sec, keys);
+        return keys ;
+    }
 
-    keys = (char**) malloc(nkeys*sizeof(char*));
+    keys = (char**) malloc(d->scount[sec]*sizeof(char*));
+    if (keys==NULL) return NULL ;
 
-    seclen  = (int)strlen(s);
-    sprintf(keym, "%s:", s);
-    
     i = 0;
-
-    for (j=0 ; j<d->size ; j++) {
-        if (d->key[j]==NULL)
-            continue ;
-        if (!strncmp(d->key[j], strlwc(keym), seclen+1)) {
-            keys[i] = d->key[j];
-            i++;
-        }
+    for (j=d->shead[sec] ; j>=0 ; j=d->snext[j]) {
+        keys[i] = d->key[j];
+        i++;
     }
 
     return keys;
@@ -369,12 +576,17 @@ char * iniparser_getstring(dictionary * d, const char * key, char * def)
 {
     char * lc_key ;
     char * sval ;
+    char tmp_str[ASCIILINESZ+1];
 
     if (d==NULL || key==NULL)
         return def ;
 
-    lc_key = strlwc(key);
+    lc_key = strlwc_key(key, tmp_str, sizeof(tmp_str));
+    if (lc_key==NULL)
+        return def ;
     sval = dictionary_get(d, lc_key, def);
+    if (lc_key!=tmp_str)
+        free(lc_key);
     return sval ;
 }
 
@@ -524,7 +736,37 @@ int iniparser_find_entry(
 /*--------------------------------------------------------------------------*/
 int iniparser_set(dictionary * ini, const char * entry, const char * val)
 {
-    return dictionary_set(ini, strlwc(entry), val) ;
+    char tmp_str[ASCIILINESZ+1];
+    char * lc_entry ;
+    int    indexed, size, slot, section ;
+    int    err ;
+
+    lc_entry = strlwc_key(entry, tmp_str, sizeof(tmp_str));
+    if (lc_entry==NULL)
+        return -1 ;
+    indexed = ini!=NULL && ini->shead!=NULL && ini->sgen==ini->gen ;
+    size    = ini!=NULL ? ini->size : 0 ;
+    slot    = dictionary_getslot(ini, lc_entry);
+    section = slot>=0 && ini->val[slot]==NULL ;
+    err = dictionary_set(ini, lc_entry, val);
+    if (!err && slot<0)
+        slot = dictionary_getslot(ini, lc_entry);
+    if (lc_entry!=tmp_str)
+        free(lc_entry);
+    if (err)
+        return -1 ;
+
+    /* Keys are linked in place, sections may take over keys of others.
+       A failed rebuild leaves no index; lookups then scan instead. */
+    if (!indexed || ini->size!=size || section!=(val==NULL)) {
+        iniparser_index_sections(ini);
+    } else if (ini->sgen!=ini->gen) {
+        if (iniparser_link_key(ini, slot))
+            iniparser_index_sections(ini);
+        else
+            ini->sgen = ini->gen ;
+    }
+    return 0 ;
 }
 
 /*-------------------------------------------------------------------------*/
@@ -539,77 +781,247 @@ int iniparser_set(dictionary * ini, const char * entry, const char * val)
 /*--------------------------------------------------------------------------*/
 void iniparser_unset(dictionary * ini, const char * entry)
 {
-    dictionary_unset(ini, strlwc(entry));
+    char tmp_str[ASCIILINESZ+1];
+    char * lc_entry ;
+    int    indexed, slot ;
+
+    lc_entry = strlwc_key(entry, tmp_str, sizeof(tmp_str));
+    if (lc_entry==NULL)
+        return ;
+    slot = dictionary_getslot(ini, lc_entry);
+    if (slot>=0) {
+        indexed = ini->shead!=NULL && ini->sgen==ini->gen &&
+                  ini->val[slot]!=NULL && !iniparser_unlink_key(ini, slot);
+        dictionary_unset(ini, lc_entry);
+        if (indexed)
+            ini->sgen = ini->gen ;
+        else
+            iniparser_index_sections(ini);
+    }
+    if (lc_entry!=tmp_str)
+        free(lc_entry);
 }
 
 /*-------------------------------------------------------------------------*/
 /**
-  @brief    Load a single line from an INI file
-  @param    input_line  Input line, may be concatenated multi-line input
-  @param    section     Output space to store section
-  @param    key         Output space to store key
-  @param    value       Output space to store value
+  @brief    Copy a string into a growable buffer
+  @param    b       Buffer to copy to
+  @param    pos     Position in the buffer to copy to
+  @param    s       String to copy, need not be nul-terminated
+  @param    len     Number of chars to copy
+  @param    lower   Convert the copied chars to lowercase if non-zero
+  @return   int 0 if Ok, -1 if the buffer cannot grow
+
+  The buffer is nul-terminated after the copied chars.
+ */
+/*--------------------------------------------------------------------------*/
+static int inibuf_copy(
+    inibuf      *   b,
+    size_t          pos,
+    const char  *   s,
+    size_t          len,
+    int             lower)
+{
+    char    *   p ;
+    size_t      size ;
+    size_t      i ;
+
+    if (pos+len+1 > b->size) {
+        for (size=b->size ? b->size : 128 ; size<pos+len+1 ; size*=2)
+            ;
+        p = (char *)realloc(b->s, size);
+        if (p==NULL)
+            return -1 ;
+        b->s = p ;
+        b->size = size ;
+    }
+    for (i=0 ; i<len ; i++) {
+        b->s[pos+i] = lower ? (char)tolower((int)s[i]) : s[i] ;
+    }
+    b->s[pos+len] = (char)0 ;
+    b->len = pos+len ;
+    return 0 ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Trim blanks from both ends of a string
+  @param    s       Start of the string, updated
+  @param    len     Length of the string, updated
+  @return   void
+ */
+/*--------------------------------------------------------------------------*/
+static void initrim(const char ** s, size_t * len)
+{
+    while (*len && isspace((int)**s)) {
+        (*s)++ ;
+        (*len)-- ;
+    }
+    while (*len && isspace((int)(*s)[*len-1]))
+        (*len)-- ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Parse a single logical line of an INI file
+  @param    line    Start of the line, need not be nul-terminated
+  @param    len     Length of the line
+  @param    section Current section, updated for section lines
+  @param    key     Output buffer for "section:key"
+  @param    value   Output buffer for the value
   @return   line_status value
+
+  The line is tokenized in a single pass, sections and keys are lowercased
+  while being copied. A value is the text up to the first ';' or '#',
+  unless it is quoted with " or ' in which case it is the quoted text.
+  "" and '' stand for an empty value.
  */
 /*--------------------------------------------------------------------------*/
 static line_status iniparser_line(
-    const char * input_line,
-    char * section,
-    char * key,
-    char * value)
-{   
-    line_status sta ;
-    char        line[ASCIILINESZ+1];
-    int         len ;
-
-    strcpy(line, strstrip(input_line));
-    len = (int)strlen(line);
-
-    sta = LINE_UNPROCESSED ;
+    const char  *   line,
+    size_t          len,
+    inibuf      *   section,
+    inibuf      *   key,
+    inibuf      *   value)
+{
+    const char  *   p ;
+    const char  *   eq ;
+    const char  *   v ;
+    size_t          n ;
+    size_t          vlen ;
+
+    initrim(&line, &len);
+
     if (len<1) {
         /* Empty line */
-        sta = LINE_EMPTY ;
-    } else if (line[0]=='#' || line[0]==';') {
+        return LINE_EMPTY ;
+    }
+    if (line[0]=='#' || line[0]==';') {
         /* Comment line */
-        sta = LINE_COMMENT ; 
-    } else if (line[0]=='[' && line[len-1]==']') {
-        /* Section name */
-        sscanf(line, "[%[^]]", section);
-        strcpy(section, strstrip(section));
-        strcpy(section, strlwc(section));
-        sta = LINE_SECTION ;
-    } else if (sscanf (line, "%[^=] = \"%[^\"]\"", key, value) == 2
-           ||  sscanf (line, "%[^=] = '%[^\']'",   key, value) == 2
-           ||  sscanf (line, "%[^=] = %[^;#]",     key, value) == 2) {
-        /* Usual key=value, with or without comments */
-        strcpy(key, strstrip(key));
-        strcpy(key, strlwc(key));
-        strcpy(value, strstrip(value));
-        /*
-         * sscanf cannot handle '' or "" as empty values
-         * this is done here
-         */
-        if (!strcmp(value, "\"\"") || (!strcmp(value, "''"))) {
-            value[0]=0 ;
+        return LINE_COMMENT ;
+    }
+    if (line[0]=='[' && line[len-1]==']') {
+        /* Section name, up to the first ']' */
+        p = line+1 ;
+        for (n=0 ; p[n]!=']' ; n++)
+            ;
+        initrim(&p, &n);
+        if (n==0) {
+            /* "[]" names no section */
+            return LINE_ERROR ;
         }
-        sta = LINE_VALUE ;
-    } else if (sscanf(line, "%[^=] = %[;#]", key, value)==2
-           ||  sscanf(line, "%[^=] %[=]", key, value) == 2) {
-        /*
-         * Special cases:
-         * key=
-         * key=;
-         * key=#
-         */
-        strcpy(key, strstrip(key));
-        strcpy(key, strlwc(key));
-        value[0]=0 ;
-        sta = LINE_VALUE ;
-    } else {
+        if (inibuf_copy(section, 0, p, n, 1))
+            return LINE_ERROR ;
+        return LINE_SECTION ;
+    }
+
+    eq = memchr(line, '=', len);
+    if (eq==NULL || eq==line) {
         /* Generate syntax error */
-        sta = LINE_ERROR ;
+        return LINE_ERROR ;
+    }
+
+    /* "section:key", lowercased */
+    p = line ;
+    n = (size_t)(eq - line) ;
+    initrim(&p, &n);
+    if (inibuf_copy(key, 0, section->s ? section->s : "", section->len, 0)
+        || inibuf_copy(key, section->len, ":", 1, 0)
+        || inibuf_copy(key, section->len+1, p, n, 1))
+        return LINE_ERROR ;
+
+    v = eq+1 ;
+    vlen = (size_t)(line+len - v) ;
+    while (vlen && isspace((int)*v)) {
+        v++ ;
+        vlen-- ;
+    }
+
+    n = 0 ;
+    if (vlen>1 && (*v=='"' || *v=='\'') && v[1]!=*v) {
+        /* Quoted value, up to the closing quote if any */
+        for (n=1 ; n<vlen && v[n]!=*v ; n++)
+            ;
+        p = v+1 ;
+        n = n-1 ;
+    } else {
+        /* Plain value, up to a comment */
+        p = v ;
+        while (n<vlen && v[n]!=';' && v[n]!='#')
+            n++ ;
+    }
+    initrim(&p, &n);
+    if ((n==2 && p[0]=='"' && p[1]=='"') || (n==2 && p[0]=='\'' && p[1]=='\''))
+        n = 0 ;
+    if (inibuf_copy(value, 0, p, n, 0))
+        return LINE_ERROR ;
+
+    return LINE_VALUE ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Map an ini file into memory
+  @param    ininame Name of the ini file to read.
+  @param    size    Output: size of the file contents
+  @param    mapped  Output: 1 if the contents are mmap'ed, 0 if allocated
+  @return   Pointer to the file contents, NULL on error
+
+  Files that cannot be mapped (pipes, character devices) are read into
+  an allocated buffer instead. An empty file yields an empty, allocated
+  buffer.
+ */
+/*--------------------------------------------------------------------------*/
+static char * iniparser_map(const char * ininame, size_t * size, int * mapped)
+{
+    struct stat st ;
+    char    *   data ;
+    char    *   p ;
+    size_t      alloc ;
+    ssize_t     r ;
+    int         fd ;
+
+    if ((fd=open(ininame, O_RDONLY))<0)
+        return NULL ;
+
+    *mapped = 0 ;
+    *size = 0 ;
+    data = NULL ;
+
+    if (fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data!=MAP_FAILED) {
+            *mapped = 1 ;
+            *size = (size_t)st.st_size ;
+            close(fd);
+            return data ;
+        }
+        data = NULL ;
     }
-    return sta ;
+
+    alloc = 0 ;
+    do {
+        if (*size==alloc) {
+            alloc = alloc ? 2*alloc : 4096 ;
+            p = (char *)realloc(data, alloc);
+            if (p==NULL) {
+                free(data);
+                close(fd);
+                return NULL ;
+            }
+            data = p ;
+        }
+        r = read(fd, data+*size, alloc-*size);
+        if (r>0)
+            *size += (size_t)r ;
+    } while (r>0 || (r<0 && errno==EINTR));
+
+    close(fd);
+    if (r<0) {
+        free(data);
+        return NULL ;
+    }
+    return data ;
 }
 
 /*-------------------------------------------------------------------------*/
@@ -623,109 +1035,139 @@ static line_status iniparser_line(
   should not be accessed directly, but through accessor functions
   instead.
 
+  The file is mapped and tokenized in a single forward pass. Lines have
+  no length limit. A line ending with a backslash continues on the next
+  line.
+
   The returned dictionary must be freed using iniparser_freedict().
  */
 /*--------------------------------------------------------------------------*/
 dictionary * iniparser_load(const char * ininame)
 {
-    FILE * in ;
+    char    *   data ;
+    const char *p ;
+    const char *end ;
+    const char *eol ;
+    const char *line ;
+    size_t      size ;
+    size_t      len ;
+    int         mapped ;
+    int         cont ;
+
+    inibuf  buf ;
+    inibuf  section ;
+    inibuf  key ;
+    inibuf  val ;
 
-    char line    [ASCIILINESZ+1] ;
-    char section [ASCIILINESZ+1] ;
-    char key     [ASCIILINESZ+1] ;
-    char tmp     [ASCIILINESZ+1] ;
-    char val     [ASCIILINESZ+1] ;
-
-    int  last=0 ;
-    int  len ;
     int  lineno=0 ;
     int  errs=0;
 
     dictionary * dict ;
 
-    if ((in=fopen(ininame, "r"))==NULL) {
+    if ((data=iniparser_map(ininame, &size, &mapped))==NULL) {
         fprintf(stderr, "iniparser: cannot open %s\n", ininame);
         return NULL ;
     }
 
     dict = dictionary_new(0) ;
     if (!dict) {
-        fclose(in);
+        if (mapped)
+            munmap(data, size);
+        else
+            free(data);
         return NULL ;
     }
 
-    memset(line,    0, ASCIILINESZ);
-    memset(section, 0, ASCIILINESZ);
-    memset(key,     0, ASCIILINESZ);
-    memset(val,     0, ASCIILINESZ);
-    last=0 ;
-
-    while (fgets(line+last, ASCIILINESZ-last, in)!=NULL) {
+    memset(&buf,     0, sizeof(buf));
+    memset(&section, 0, sizeof(section));
+    memset(&key,     0, sizeof(key));
+    memset(&val,     0, sizeof(val));
+    cont = 0 ;
+
+    p = data ;
+    end = data+size ;
+    while (p<end) {
+        eol = memchr(p, '\n', (size_t)(end-p));
+        if (eol==NULL)
+            eol = end ;
+        line = p ;
+        len = (size_t)(eol-p) ;
+        p = eol+1 ;
         lineno++ ;
-        len = (int)strlen(line)-1;
-        if (len==0)
-            continue;
-        /* Safety check against buffer overflows */
-        if (line[len]!='\n') {
-            fprintf(stderr,
-                    "iniparser: input line too long in %s (%d)\n",
-                    ininame,
-                    lineno);
-            dictionary_del(dict);
-            fclose(in);
-            return NULL ;
-        }
-        /* Get rid of \n and spaces at end of line */
-        while ((len>=0) &&
-                ((line[len]=='\n') || (isspace(line[len])))) {
-            line[len]=0 ;
+
+        /* Get rid of spaces at end of line */
+        while (len && isspace((int)line[len-1]))
             len-- ;
-        }
-        /* Detect multi-line */
-        if (line[len]=='\\') {
-            /* Multi-line value */
-            last=len ;
+
+        /* Detect multi-line, the backslash is dropped */
+        if (len && line[len-1]=='\\') {
+            if (inibuf_copy(&buf, cont ? buf.len : 0, line, len-1, 0)) {
+                errs = -1 ;
+                break ;
+            }
+            cont = 1 ;
             continue ;
-        } else {
-            last=0 ;
         }
-        switch (iniparser_line(line, section, key, val)) {
+        if (cont) {
+            if (inibuf_copy(&buf, buf.len, line, len, 0)) {
+                errs = -1 ;
+                break ;
+            }
+            line = buf.s ;
+            len = buf.len ;
+            cont = 0 ;
+        }
+
+        switch (iniparser_line(line, len, &section, &key, &val)) {
             case LINE_EMPTY:
             case LINE_COMMENT:
             break ;
 
+            /* keep the count of syntax errors, -1 is out of memory */
             case LINE_SECTION:
-            errs = dictionary_set(dict, section, NULL);
+            if (dictionary_set(dict, section.s ? section.s : "", NULL))
+                errs = -1 ;
             break ;
 
             case LINE_VALUE:
-            sprintf(tmp, "%s:%s", section, key);
-            errs = dictionary_set(dict, tmp, val) ;
+            if (dictionary_set(dict, key.s, val.s))
+                errs = -1 ;
             break ;
 
             case LINE_ERROR:
             fprintf(stderr, "iniparser: syntax error in %s (%d):\n",
                     ininame,
                     lineno);
-            fprintf(stderr, "-> %s\n", line);
+            fprintf(stderr, "-> %.*s\n", (int)len, line);
             errs++ ;
             break;
 
             default:
             break ;
         }
-        memset(line, 0, ASCIILINESZ);
-        last=0;
         if (errs<0) {
-            fprintf(stderr, "iniparser: memory allocation failure\n");
             break ;
         }
     }
+    if (errs<0) {
+        fprintf(stderr, "iniparser: memory allocation failure\n");
+    }
+    if (!errs && iniparser_index_sections(dict)) {
+        fprintf(stderr, "iniparser: memory allocation failure\n");
+        errs = -1 ;
+    }
     if (errs) {
         dictionary_del(dict);
         dict = NULL ;
     }
-    fclose(in);
+    free(buf.s);
+    free(section.s);
+    free(key.s);
+    free(val.s);
+    if (mapped)
+        munmap(data, size);
+    else
+        free(data);
     return dict ;
 }
 
@@ -129,6 +129,8 @@ int iniparser_getsecnkeys(dictionary * d, const char * s);
   @return   pointer to statically allocated character strings
 
   This function queries a dictionary and finds all keys in a given section.
+  When section names contain colons, a key belongs to the longest section
+  its name starts with, e.g. "a:b:x" to section "a:b" rather than "a".
   Each pointer in the returned char pointer-to-pointer is pointing to
   a string allocated in the dictionary; do not free or modify them.
 
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iniparser.h"
+
+static int failed ;
+
+/* Keys of a section, from the section index or, with scan set, from
+   the fallback that looks at every entry */
+static char * section_keys(dictionary * d, const char * s, int scan)
+{
+    static char out[1024];
+    char    **  keys ;
+    int         n, i ;
+
+    if (scan)
+        d->gen++ ;
+    n = iniparser_getsecnkeys(d, s);
+    keys = iniparser_getseckeys(d, s);
+    if (scan)
+        d->gen-- ;
+
+    out[0] = '\0' ;
+    for (i=0 ; i<n ; i++) {
+        if (i)
+            strcat(out, " ");
+        strcat(out, keys[i]);
+    }
+    free(keys);
+    return out ;
+}
+
+static void expect(dictionary * d, const char * s, const char * want)
+{
+    char    fast[1024];
+
+    strcpy(fast, section_keys(d, s, 0));
+    if (strcmp(fast, want)) {
+        printf("[%s] index: got [%s] want [%s]\n", s, fast, want);
+        failed = 1 ;
+    }
+    if (strcmp(section_keys(d, s, 1), want)) {
+        printf("[%s] scan: got [%s] want [%s]\n", s,
+               section_keys(d, s, 1), want);
+        failed = 1 ;
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    static const char * secs[] = { "a", "a:b", "a:b:c", "d" };
+    dictionary  *   d ;
+    char            key[32] ;
+    char            fast[1024] ;
+    int             i, j ;
+
+    d = iniparser_load(argc<2 ? "twisted-colon.ini" : argv[1]);
+    if (d==NULL)
+        return 1 ;
+
+    expect(d, "a", "a:x a:y a:b");
+    expect(d, "a:b", "a:b:x a:b:c");
+    expect(d, "a:b:c", "a:b:c:x");
+    expect(d, "d", "d:x");
+
+    /* Keys are linked and unlinked in place */
+    iniparser_set(d, "a:b:z", "6");
+    iniparser_unset(d, "a:y");
+    expect(d, "a", "a:x a:b");
+    expect(d, "a:b", "a:b:x a:b:c a:b:z");
+
+    /* A removed section hands its keys to the next shorter one */
+    iniparser_unset(d, "a:b:c");
+    expect(d, "a:b", "a:b:x a:b:c:x a:b:z");
+    iniparser_set(d, "a:b:c", NULL);
+    expect(d, "a:b", "a:b:x a:b:z a:b:c");
+    expect(d, "a:b:c", "a:b:c:x");
+
+    /* Reused slots keep the index in slot order */
+    for (i=0 ; i<200 ; i++) {
+        sprintf(key, "%s:k%d", secs[i%4], (i*7)%23);
+        if (i%3)
+            iniparser_set(d, key, "v");
+        else
+            iniparser_unset(d, key);
+        for (j=0 ; j<4 ; j++) {
+            strcpy(fast, section_keys(d, secs[j], 0));
+            if (strcmp(fast, section_keys(d, secs[j], 1))) {
+                printf("[%s] index [%s] differs from scan [%s]\n",
+                       secs[j], fast, section_keys(d, secs[j], 1));
+                failed = 1 ;
+            }
+        }
+    }
+
+    iniparser_freedict(d);
+    printf(failed ? "seckeys failed\n" : "seckeys ok\n");
+    return failed ;
+}